@@ -1,104 +1,157 @@
 #include "av_SDL.h"
+#include <cmath>
 
-// 音频数据回调函数
-void read_audio_data(void *udata, Uint8 *stream, int len){
+// 音频数据回调函数, 返回实际填充的字节数
+static int read_audio_data(void *udata, uint8_t *stream, int len){
+    AV_TRACE_THREAD("audio_callback");
+    AV_TRACE_SCOPE("audio_callback");
     AvProcessor* processor = (AvProcessor*)udata;
-    processor->audio_chunk_pop(stream, len);
+    return processor->audio_chunk_pop(stream, len);
 }
 
+// SDL_USEREVENT的子类型
+enum{
+    VIDEO_REFRESH_EVENT = 0,    // 视频定时播放
+    TICK_EVENT,                 // 周期性检查(如输入是否结束)
+};
+
+static const double SEEK_STEP = 3;  // 左右键快退/快进的距离, s
+
 // 视频定时器
 static Uint32 video_timer(Uint32 interval, void *opaque) {
   SDL_Event event;    // 初始化事件
   event.type = SDL_USEREVENT;  // 事件类型
+  event.user.code = VIDEO_REFRESH_EVENT;
   event.user.data1 = opaque;
   SDL_PushEvent(&event);
   return 0; // 1次触发后不会再次触发
 }
 
-Player::Player(AvProcessor* processor):processor(processor){
-    int h, w;
-    h = this->processor->get_h();
-    w = this->processor->get_w();
-    // 1. 初始化SDL
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER) < 0)
+// 周期定时器
+static Uint32 tick_timer(Uint32 interval, void *opaque) {
+  SDL_Event event;
+  event.type = SDL_USEREVENT;
+  event.user.code = TICK_EVENT;
+  event.user.data1 = opaque;
+  SDL_PushEvent(&event);
+  return interval;    // 返回下次触发的间隔, 周期触发
+}
+
+Player::Player(AvProcessor* processor, const PlayerConfig& config):processor(processor), config(config),
+    frame_cache(config.cache_mb > 0 ? (int64_t)config.cache_mb << 20 : 0){
+    // 1. 初始化SDL事件和定时器, 视频、音频子系统由对应的SDL输出后端初始化
+    if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_EVENTS) < 0)
     {
         av_log(NULL, AV_LOG_ERROR, "SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
         this->invalid = SDL_INIT_FAILED;
         return;
     }
 
-    // 2. 初始化视频相关
-    // 2.1 创建窗口
-    this->window = SDL_CreateWindow("basic_AV_Player", SDL_WINDOWPOS_UNDEFINED, 
-        SDL_WINDOWPOS_UNDEFINED, w, h, SDL_WINDOW_OPENGL|SDL_WINDOW_RESIZABLE);
-    if (!this->window) {
-        av_log(NULL, AV_LOG_ERROR, "Window could not be created! SDL_Error: %s\n", SDL_GetError());
-        this->invalid = CREAT_WINDOW_FAILED;
-        return;
+    // 2. 长时间运行测试: 打开报告, 循环播放
+    if (this->config.soak){
+        this->config.loop = 1;
+        this->soak = new AvSoak(this->processor, this->config.soak_config);
+        if (this->soak->open() < 0){
+            this->invalid = OPEN_SOAK_REPORT_FAILED;
+            return;
+        }
     }
 
-    // 2.2 创建渲染器
-    this->renderer = SDL_CreateRenderer(this->window, -1, 0);
-    if (!this->renderer) {
-        av_log(NULL, AV_LOG_ERROR, "Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
-        this->invalid = CREAT_RENDERER_FAILED;
-        return;
+    // 3. 创建输出后端(不存在的流不创建)
+    if (this->processor->has_video()){
+        this->video_sink = create_video_sink(this->config.video_out);
+        if (!this->video_sink){
+            av_log(NULL, AV_LOG_ERROR, "invalid video output: %s\n", this->config.video_out);
+            this->invalid = CREAT_SINK_FAILED;
+            return;
+        }
     }
+    if (this->processor->has_audio()){
+        this->audio_sink = create_audio_sink(this->config.audio_out, !this->config.free_run);
+        if (!this->audio_sink){
+            av_log(NULL, AV_LOG_ERROR, "invalid audio output: %s\n", this->config.audio_out);
+            this->invalid = CREAT_SINK_FAILED;
+            return;
+        }
+    }
+    // 没有实时输出给用户的后端(窗口/声卡)时无法交互, 播放完自动退出
+    if (!(this->video_sink && this->video_sink->interactive()) && !(this->audio_sink && this->audio_sink->interactive()))
+        this->config.autoexit = 1;
 
-    // 2.3 创建纹理
-    this->texture = SDL_CreateTexture(this->renderer, SDL_PIXELFORMAT_IYUV, 
-        SDL_TEXTUREACCESS_STREAMING, w, h);
-    if (!this->texture) {
-        av_log(NULL, AV_LOG_ERROR, "Texture could not be created! SDL_Error: %s\n", SDL_GetError());
-        this->invalid = CREAT_TEXTURE_FAILED;
+    // 4. 打开视频输出
+    if (this->video_sink && this->video_sink->open(this->processor->get_w(), this->processor->get_h()) < 0){
+        this->invalid = OPEN_VIDEO_FAILED;
         return;
     }
+    // 自动大小的帧缓存: 能放下一次快退距离(再多1s余量)的帧, 按不缩放的输出帧大小估计
+    if (this->video_sink && this->config.cache_mb < 0){
+        AVRational fps = this->processor->get_video_frame_rate();
+        int64_t frame_bytes = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, this->processor->get_w(), this->processor->get_h(), 32);
+        if (fps.num > 0 && fps.den > 0 && frame_bytes > 0)
+            this->frame_cache.set_budget((int64_t)(frame_bytes * av_q2d(fps) * (SEEK_STEP + 1)));
+    }
 
-    // 3. 初始化音频相关
-    // 3.1 设置参数(回调函数是因为声卡是拉数据而不是我们推给他)
-    this->spec.freq = this->processor->get_sample_rate();
-    this->spec.format = AUDIO_S16SYS;
-    this->spec.channels = this->processor->get_channels();
-    this->spec.silence = 0;
-    this->spec.samples = 2048;
-    this->spec.callback = read_audio_data;
-    this->spec.userdata = this->processor;
-    // 3.2 打开音频设备
-    if(SDL_OpenAudio(&this->spec, NULL)){
-        av_log(NULL, AV_LOG_ERROR, "Failed to open audio device, %s\n", SDL_GetError());
+    // 5. 打开音频输出(纯视频时不打开, 同步到外部时钟)
+    if (!this->audio_sink){
+        return;
+    }
+    AudioParams params;
+    params.freq = this->processor->get_sample_rate();
+    params.channels = this->processor->get_channels();
+    params.samples = this->config.audio_samples ? this->config.audio_samples : (this->config.low_latency ? 512 : 2048);
+    if (this->audio_sink->open(params, read_audio_data, this->processor) < 0){
         this->invalid = OPEN_AUDIO_FAILED;
         return;
     }
+    // 6. 重采样输出跟随声卡实际参数, 音频时钟计入声卡缓冲的延迟
+    if (this->processor->set_audio_output(params.freq, params.channels, params.latency_samples) < 0){
+        this->invalid = OPEN_AUDIO_FAILED;
+        return;
+    }
+    this->processor->stats.a_dev_samples = params.samples;
+    if (this->config.low_latency)
+        this->processor->set_audio_low_latency(2 * params.samples * params.channels * 2);  // S16
 }
 
 Player::~Player(){
-    switch (this->invalid){
-    case 0: 
-    case VIDEO_FRAME_BROKE:
-    case CREAT_DEMUX_THREAD_FAILED:
-    case OPEN_AUDIO_FAILED:
-        SDL_DestroyTexture(texture);
-    case CREAT_TEXTURE_FAILED:
-        SDL_DestroyRenderer(renderer);
-    case CREAT_RENDERER_FAILED:
-        SDL_DestroyWindow(window);
-    case CREAT_WINDOW_FAILED:
+    av_frame_free(&this->frame);    // 取出但还没显示的帧
+    delete this->audio_sink;        // 先停止音频拉取
+    delete this->video_sink;
+    delete this->soak;              // 写出汇总
+    if (this->invalid != SDL_INIT_FAILED)
         SDL_Quit();
-    case SDL_INIT_FAILED:;
+}
+
+// 暂停/继续主时钟(有音频时暂停音频输出, 否则暂停外部时钟)
+void Player::pause(int pause_on){
+    if (this->audio_sink){
+        this->audio_sink->pause(pause_on);  // 非0是暂停, 0是播放
+        this->processor->pause_audio_clock(pause_on);
     }
+    else
+        this->processor->pause_ext_clock(pause_on);
+    if (this->soak)     // 暂停的时间不算帧间隔
+        this->soak->reset_frame_clock();
 }
 
 int Player::play(){
-    // 1. 创建解复用线程
+    if (this->invalid){
+        return this->invalid;
+    }
+    AV_TRACE_THREAD("main");
+    // 1. 没有音频时从0开始走外部时钟(直播时由解复用线程按第一个packet重设, 所以在创建线程前设置), 创建解复用线程
+    this->processor->set_ext_clock(0);
     SDL_Thread* demux_tid = SDL_CreateThread(AvProcessor::demux_thread, "demux_thread", this->processor);
     if (!demux_tid) {
         av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread demux_thread failed\n");
         return (this->invalid = CREAT_DEMUX_THREAD_FAILED);
     }
     // 2. 播放音频
-    SDL_PauseAudio(0);  // 播放音频(非0是暂停, 0是播放)
-    // 3. 创建视频播放定时器
-    SDL_AddTimer(40, video_timer, this->processor);
+    this->pause(0);
+    // 3. 创建视频播放定时器(纯音频时不需要)和周期定时器
+    if (this->processor->has_video())
+        SDL_AddTimer(40, video_timer, this->processor);
+    SDL_TimerID tick_id = SDL_AddTimer(100, tick_timer, this->processor);
     // 4. 事件循环
     int running = 1;    // 第1位是是否播放, 第2位是是否暂停
     while(running){
@@ -106,63 +159,153 @@ int Player::play(){
         switch (this->event.type)
         {
         case SDL_QUIT:  // 退出事件
+            SDL_RemoveTimer(tick_id);
             this->processor->stop();
             SDL_WaitThread(demux_tid, nullptr);
+            this->processor->stats.report();
             running = 0;
             break;
+        case SDL_WINDOWEVENT:   // 窗口事件
+            if (this->event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED && this->video_sink){
+                int w, h;
+                if (this->video_sink->output_size(&w, &h))
+                    this->processor->set_output_size(w, h);
+            }
+            break;
         case SDL_KEYDOWN:   // 键盘事件
             switch (event.key.keysym.sym){
             case SDLK_SPACE:
                 running ^= 2;   // 暂停
-                SDL_PauseAudio(running & 2);    // 暂停音频
+                if (!(running & 2))
+                    this->cache_resume();
+                this->pause(running & 2);
                 break;
-            case SDLK_LEFT:     // 快退3s
-                SDL_PauseAudio(1);  // 播放音频(非0是暂停, 0是播放)
-                this->processor->set_seek_flag(-1, this->processor->get_audio_clock()-3);
+            case SDLK_LEFT:     // 快退3s(旧位置的PCM数据由音频解码线程在seek时清空, 不需要暂停音频)
+                if (this->cache_seek(-SEEK_STEP)){  // 先查缓存帧, 命中时立即显示目标帧
+                    if (!(running & 2))     // 播放中: 从该帧的准确位置seek继续播放, 新帧到来前画面停在该帧
+                        this->cache_resume();
+                    break;
+                }
+                this->cache_pos = -1;
+                this->frame_cache.clear();
+                this->processor->set_seek_flag(-1, this->processor->get_master_clock()-SEEK_STEP);
                 break;
             case SDLK_RIGHT:    // 快进3s
-                SDL_PauseAudio(1);  // 播放音频(非0是暂停, 0是播放)
-                this->processor->set_seek_flag(1, this->processor->get_audio_clock()+3);
+                this->cache_pos = -1;
+                this->frame_cache.clear();
+                this->processor->set_seek_flag(1, this->processor->get_master_clock()+SEEK_STEP);
+                break;
+            case SDLK_COMMA:    // 后退一帧
+            case SDLK_PERIOD:   // 前进一帧
+                if (!this->processor->has_video())
+                    break;
+                if (!(running & 2)){    // 步进前先暂停
+                    running |= 2;
+                    this->pause(1);
+                }
+                this->step_frame(event.key.keysym.sym == SDLK_PERIOD ? 1 : -1);
+                break;
+            case SDLK_i:        // 打印统计信息
+                this->processor->stats.report();
                 break;
             }
             break;
-        case SDL_USEREVENT: // 视频定时播放事件
-            this->timer_video_display();
+        case SDL_USEREVENT:
+            if (this->event.user.code == VIDEO_REFRESH_EVENT){  // 视频定时播放事件
+                this->timer_video_display();
+            }else if (this->event.user.code == TICK_EVENT){
+                int done = this->processor->finished() && !this->frame;
+                if (this->config.loop){     // 循环播放: 数据都输出后回到开头(seek会清空解码器的结束状态)
+                    if (done && !this->loop_pending){
+                        this->processor->set_seek_flag(-1, 0);
+                        this->loop_pending = 1;
+                        if (this->soak)
+                            this->soak->loops++;
+                    }else if (!done){
+                        this->loop_pending = 0;
+                    }
+                }else if (this->config.autoexit && done){  // 输入结束且数据都已输出时自动退出
+                    SDL_Event quit;
+                    quit.type = SDL_QUIT;
+                    SDL_PushEvent(&quit);
+                }
+                // 长时间运行测试: 到达运行时长或超过阈值时退出
+                if (this->soak && this->soak->tick() != 0){
+                    SDL_Event quit;
+                    quit.type = SDL_QUIT;
+                    SDL_PushEvent(&quit);
+                }
+            }
             break;
         default:
             // av_log(nullptr, AV_LOG_INFO, "event.type %d\n", event.type);
             break;
         }
     }
-    return 0;
+    return (this->soak && this->soak->failed) ? SOAK_FAILED : 0;
 }
 
-int Player::timer_video_display(){
+int Player::timer_video_display(int step){
     static double first_delay = 0;  // 用来同步音视频第一个帧所需的延迟
     static int flag = 0;
-    // 1. 从队列中取出视频帧
-    if (this->frame==nullptr)
-        this->frame = this->processor->video_frame_pop();
+    // 正在显示缓存帧(暂停时后退过), 不从队列取新帧
+    if (this->cache_pos >= 0){
+        if (!step)
+            SDL_AddTimer(10, video_timer, this->processor);
+        return 0;
+    }
+    // 1. 从队列中取出视频帧(非阻塞, 队列为空时稍后重试, 避免阻塞事件循环)
+    if (this->frame==nullptr){
+        if (!this->processor->video_frame_try_pop(this->frame)){
+            if (!step)
+                SDL_AddTimer(10, video_timer, this->processor);
+            return 0;
+        }
+        AV_TRACE_INSTANT("frame_dequeue");
+    }
     if (!this->frame) {
         av_log(NULL, AV_LOG_ERROR, "frame is NULL\n");
         return (this->invalid = VIDEO_FRAME_BROKE);
     }
-    // 2. 计算视频同步到音频需要的延迟(下一视频帧时间戳-音频帧时间戳, <0则说明视频慢了, 应加速播放)
+    // 2. 计算视频同步到主时钟需要的延迟(下一视频帧时间戳-主时钟, <0则说明视频慢了, 应加速播放)
     double video_clock = this->processor->get_video_clock(this->frame);
-    double audio_clock = this->processor->get_audio_clock();
-    double delay = video_clock - audio_clock - first_delay;
-    av_log(NULL, AV_LOG_DEBUG, "delay: %f, video_clock: %f, audio_clock: %f\n", delay, video_clock, audio_clock);
+    double master_clock = this->processor->get_master_clock();
+    double delay = video_clock - master_clock - first_delay;
+    av_log(NULL, AV_LOG_DEBUG, "delay: %f, video_clock: %f, master_clock: %f\n", delay, video_clock, master_clock);
     if (!flag){     // 只记录第一次的延迟
         first_delay = delay;
         flag = 1;
     }
     av_log(NULL, AV_LOG_DEBUG, "delay: %f\n", delay);
     
-    if (flag && abs(delay)>1){  // 差太大，快进快退模式
-        av_freep(&frame);
+    if (step){      // 单帧步进(暂停中主时钟不走): 不管是否到时间都显示, 定时器仍由原来的定时器链设置
+        double target = this->processor->take_seek_landing(this->frame);
+        if (target >= 0)
+            this->processor->stats.add_seek_landing(video_clock - target);
+        this->video_display(this->frame);
         this->frame = nullptr;
+    }else if (this->config.free_run){     // 不同步, 立即输出并马上处理下一帧
+        if (this->processor->take_seek_landing(this->frame) >= 0 && this->soak)    // seek(循环)后的第一帧
+            this->soak->reset_frame_clock();
+        if (this->soak)
+            this->soak->on_frame(delay);
+        this->video_display(this->frame);
+        this->frame = nullptr;
+        video_timer(0, this->processor);
+    }else if (flag && std::abs(delay)>1){  // 差太大，快进快退模式
+        av_frame_free(&this->frame);
+        this->processor->stats.v_frames_dropped++;
         SDL_AddTimer(1, video_timer, this->processor);
     }else if (delay <= 0){    // 视频慢了
+        this->processor->stats.add_sync_error(delay);
+        double target = this->processor->take_seek_landing(this->frame);
+        if (target >= 0){   // seek后显示的第一帧(按flush序号识别, 不会是seek前留在队列中的帧), 统计落点误差
+            this->processor->stats.add_seek_landing(video_clock - target);
+            if (this->soak)     // seek(含循环)中断的时间不算帧间隔
+                this->soak->reset_frame_clock();
+        }
+        if (this->soak)
+            this->soak->on_frame(delay);
         this->video_display(this->frame);   // 显示视频
         this->frame = nullptr;
         SDL_AddTimer(1, video_timer, this->processor);  // 1ms后再次调用timer_video_display
@@ -173,18 +316,83 @@ int Player::timer_video_display(){
     return 0;
 }
 
-// 播放一帧视频
+// 播放一帧视频, 之后放入缓存(不缓存时释放)
 int Player::video_display(AVFrame* frame){
-    // 2. 更新纹理
-    SDL_UpdateYUVTexture(this->texture, NULL, frame->data[0], frame->linesize[0], 
-        frame->data[1], frame->linesize[1], frame->data[2], frame->linesize[2]);
-    // 3. 清空渲染器
-    SDL_RenderClear(this->renderer);
-    // 4. 拷贝纹理到渲染器
-    SDL_RenderCopy(this->renderer, this->texture, NULL, NULL);
-    // 5. 显示
-    SDL_RenderPresent(this->renderer);
-    // 6. 释放帧
-    av_freep(&frame);
-    return 0;
-}
\ No newline at end of file
+    this->processor->add_display_latency(frame);    // 缓存帧重新显示时不统计
+    int ret = this->show_frame(frame);
+    if (this->frame_cache.enabled()){
+        this->frame_cache.push(frame);
+        this->processor->stats.cache_frames = this->frame_cache.size();
+        this->processor->stats.cache_bytes = this->frame_cache.memory();
+    }else{
+        av_frame_free(&frame);
+    }
+    return ret;
+}
+
+// 输出一帧视频并统计, 不释放帧
+int Player::show_frame(AVFrame* frame){
+    AV_TRACE_SCOPE("display");
+    AV_TRACE_FLOW('f', "video", this->processor->flow_id(frame));
+    // 1. 输出到视频后端
+    int ret = this->video_sink->display(frame);
+    // 2. 统计
+    int64_t upload_bytes = (int64_t)frame->linesize[0] * frame->height
+        + (int64_t)(frame->linesize[1] + frame->linesize[2]) * ((frame->height + 1) / 2);
+    this->processor->stats.v_last_upload_bytes = upload_bytes;
+    this->processor->stats.v_upload_bytes += upload_bytes;
+    this->processor->stats.v_frames_displayed++;
+    return ret;
+}
+
+// 显示第i个缓存帧, 最新的一帧表示回到正常播放位置
+void Player::show_cached(int i){
+    this->cache_pos = (i == this->frame_cache.size() - 1) ? -1 : i;
+    this->show_frame(this->frame_cache.at(i));
+    this->processor->stats.cache_hits++;
+}
+
+void Player::step_frame(int dir){
+    int cur = this->cache_pos >= 0 ? this->cache_pos : this->frame_cache.size() - 1;
+    // 1. 后退: 只能从缓存取
+    if (dir < 0){
+        if (cur >= 1)
+            this->show_cached(cur - 1);
+        else
+            this->processor->stats.cache_misses++;
+        return;
+    }
+    // 2. 前进: 在缓存中间时取下一个缓存帧
+    if (this->cache_pos >= 0){
+        this->show_cached(cur + 1);
+        return;
+    }
+    // 3. 已在最新帧, 显示解码好的下一帧(和定时显示走同一路径, 继续播放时等主时钟追上)
+    this->timer_video_display(1);
+}
+
+int Player::cache_seek(double offset){
+    if (this->frame_cache.size() == 0)
+        return 0;
+    // 1. 以正在显示的帧为起点计算目标pts
+    int cur = this->cache_pos >= 0 ? this->cache_pos : this->frame_cache.size() - 1;
+    int64_t target = this->frame_cache.at(cur)->pts
+        + av_rescale_q((int64_t)(offset * AV_TIME_BASE), AV_TIME_BASE_Q, this->processor->get_video_time_base());
+    // 2. 目标早于最旧的缓存帧时走正常seek
+    if (target < this->frame_cache.at(0)->pts){
+        this->processor->stats.cache_misses++;
+        return 0;
+    }
+    this->show_cached(this->frame_cache.find(target));
+    return 1;
+}
+
+void Player::cache_resume(){
+    if (this->cache_pos < 0)
+        return;
+    // 音频已经在更后的位置, 从正在显示的帧重新seek, 缓存在新帧到来时因pts回退而清空
+    double pos = this->processor->get_video_clock(this->frame_cache.at(this->cache_pos));
+    this->cache_pos = -1;
+    av_frame_free(&this->frame);
+    this->processor->set_seek_flag(-1, pos);
+}
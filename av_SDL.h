@@ -1,36 +1,63 @@
 #pragma once
 #include "av_processor.h"
+#include "av_sink.h"
+#include "av_cache.h"
+#include "av_soak.h"
 
 extern "C"
 {
 #include <SDL2/SDL.h>
 }
 
+// 播放器配置, 由命令行参数设置
+struct PlayerConfig{
+    const char* video_out = "sdl";  // 视频输出后端: sdl, null, yuv:<file>
+    const char* audio_out = "sdl";  // 音频输出后端: sdl, null, pcm:<file>
+    int autoexit = 0;   // 输入结束后自动退出(没有窗口/声卡输出时总是自动退出)
+    int free_run = 0;   // 不做音视频同步, 尽快输出(用于测量解码吞吐)
+    int cache_mb = 0;   // 最近显示帧缓存的内存预算(MB), 0为不缓存, <0按帧大小x帧率x快退距离计算
+    int audio_samples = 0;  // 声卡缓冲区大小(样本数), 0为默认(2048, 低延迟模式512)
+    int low_latency = 0;    // 低延迟音频: 小缓冲区, audio_chunk只保持两个缓冲区的数据, 声卡回调不等待
+    int loop = 0;       // 循环播放: 数据都输出后回到开头
+    int soak = 0;       // 长时间运行测试(隐含循环播放)
+    SoakConfig soak_config;
+};
+
 class Player{
 private:
     AvProcessor* processor; // 音视频处理类
+    PlayerConfig config;
     SDL_Event event;
     int invalid = 0;
     enum ERRNO{ // 错误码
         VIDEO_FRAME_BROKE = 1,
         CREAT_DEMUX_THREAD_FAILED,
         OPEN_AUDIO_FAILED,
-        CREAT_TEXTURE_FAILED,
-        CREAT_RENDERER_FAILED,
-        CREAT_WINDOW_FAILED,
+        OPEN_VIDEO_FAILED,
+        CREAT_SINK_FAILED,
         SDL_INIT_FAILED,
+        OPEN_SOAK_REPORT_FAILED,
+        SOAK_FAILED,
     };
     // video
-    SDL_Window* window;
-    SDL_Renderer* renderer;
-    SDL_Texture* texture;
+    VideoSink* video_sink = nullptr;    // 视频输出后端
     AVFrame* frame = nullptr;
+    AvSoak* soak = nullptr;     // 长时间运行测试的采样
+    int loop_pending = 0;       // 已请求回到开头, 还没开始输出
+    AvFrameCache frame_cache;   // 最近显示过的帧, 用于单帧步进和快退
+    int cache_pos = -1;         // 正在显示的缓存帧序号, -1表示显示的是最新的帧
     // audio
-    SDL_AudioSpec spec;
+    AudioSink* audio_sink = nullptr;    // 音频输出后端
     int video_display(AVFrame* frame);    // 显示视频
-    int timer_video_display();  // 定时显示视频
+    int show_frame(AVFrame* frame);       // 输出一帧并统计, 不释放帧
+    void show_cached(int i);    // 显示第i个缓存帧
+    void step_frame(int dir);   // 单帧步进, 1前进, -1后退
+    int cache_seek(double offset);  // 从缓存帧快退, 返回0表示缓存中没有目标帧
+    void cache_resume();        // 从缓存帧继续播放时seek到该帧位置
+    int timer_video_display(int step = 0);  // 定时显示视频, step为1时是单帧步进: 立即显示下一帧, 不再设置定时器
+    void pause(int pause_on);   // 暂停/继续主时钟
 public:
-    Player(AvProcessor* processor);
+    Player(AvProcessor* processor, const PlayerConfig& config = PlayerConfig());
     ~Player();
     int play(); // 同步播放音视频
 };
@@ -0,0 +1,42 @@
+#include "av_cache.h"
+
+// 帧引用的缓冲区大小
+static int64_t frame_bytes(AVFrame* frame){
+    int64_t size = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++){
+        size += frame->buf[i]->size;
+    }
+    return size;
+}
+
+void AvFrameCache::push(AVFrame* frame){
+    if (!this->frames.empty() && frame->pts <= this->frames.back()->pts){
+        this->clear();  // 时间线不连续(seek后), 旧的帧不能用于步进
+    }
+    this->frames.push_back(frame);
+    this->bytes += frame_bytes(frame);
+    // 超过预算时丢弃最旧的帧, 至少保留刚放入的帧
+    while (this->bytes > this->budget && this->frames.size() > 1){
+        AVFrame* old = this->frames.front();
+        this->frames.pop_front();
+        this->bytes -= frame_bytes(old);
+        av_frame_free(&old);
+    }
+}
+
+void AvFrameCache::clear(){
+    for (AVFrame* frame: this->frames){
+        av_frame_free(&frame);
+    }
+    this->frames.clear();
+    this->bytes = 0;
+}
+
+int AvFrameCache::find(int64_t pts){
+    for (int i = (int)this->frames.size() - 1; i >= 0; i--){
+        if (this->frames[i]->pts <= pts){
+            return i;
+        }
+    }
+    return -1;
+}
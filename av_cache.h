@@ -0,0 +1,30 @@
+/* 最近显示过的视频帧缓存: 按pts顺序保存帧的引用(缓冲区来自帧池, 不额外拷贝), 超过内存预算时丢弃最旧的帧,
+   用于单帧步进和小范围快退, 不需要等待av_seek_frame和重新解码 */
+#pragma once
+#include <deque>
+#include <cstdint>
+
+extern "C"
+{
+#include <libavutil/frame.h>
+}
+
+class AvFrameCache{
+private:
+    std::deque<AVFrame*> frames;    // 按pts递增
+    int64_t bytes = 0;              // 缓存帧占用的内存
+    int64_t budget;                 // 内存预算, 字节
+public:
+    AvFrameCache(int64_t budget = 0): budget(budget){}
+    ~AvFrameCache(){ this->clear(); }
+    AvFrameCache(const AvFrameCache&) = delete;
+    AvFrameCache& operator=(const AvFrameCache&) = delete;
+    bool enabled(){ return this->budget > 0; }
+    void set_budget(int64_t budget){ this->budget = budget; }  // 只在放入帧之前设置
+    void push(AVFrame* frame);      // 放入帧并取得所有权, pts不递增(seek)时先清空
+    void clear();
+    int size(){ return (int)this->frames.size(); }
+    AVFrame* at(int i){ return this->frames[i]; }
+    int find(int64_t pts);          // 最后一个pts<=给定pts的帧序号, 没有返回-1
+    int64_t memory(){ return this->bytes; }
+};
@@ -0,0 +1,98 @@
+/* 常见格式组合的编译期特化转换: 视频不缩放时转为YUV420P, 音频不重采样时转为S16交错PCM
+   打开流时按源格式选定一次转换函数, 不支持的组合返回nullptr, 仍由sws_scale/swr_convert处理 */
+#pragma once
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+extern "C"
+{
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/samplefmt.h>
+}
+
+// 视频: src转换到同尺寸的YUV420P帧dst
+typedef void (*VideoConvertFunc)(const AVFrame* src, AVFrame* dst);
+// 音频: src转换为S16交错PCM写入dst, 返回字节数
+typedef int (*AudioConvertFunc)(const AVFrame* src, uint8_t* dst);
+
+namespace av_convert{
+
+// 平面YUV 4:2:0(YUV420P): 逐平面复制
+inline void yuv420p_copy(const AVFrame* src, AVFrame* dst){
+    int cw = (src->width + 1) / 2, ch = (src->height + 1) / 2;
+    av_image_copy_plane(dst->data[0], dst->linesize[0], src->data[0], src->linesize[0], src->width, src->height);
+    av_image_copy_plane(dst->data[1], dst->linesize[1], src->data[1], src->linesize[1], cw, ch);
+    av_image_copy_plane(dst->data[2], dst->linesize[2], src->data[2], src->linesize[2], cw, ch);
+}
+
+// 半平面YUV 4:2:0: U、V交错存放在同一平面, U_OFF是U在每对样本中的位置(NV12为0, NV21为1)
+template <int U_OFF>
+void nv_to_yuv420p(const AVFrame* src, AVFrame* dst){
+    int cw = (src->width + 1) / 2, ch = (src->height + 1) / 2;
+    av_image_copy_plane(dst->data[0], dst->linesize[0], src->data[0], src->linesize[0], src->width, src->height);
+    for (int y = 0; y < ch; y++){
+        const uint8_t* s = src->data[1] + (ptrdiff_t)y * src->linesize[1];
+        uint8_t* u = dst->data[1] + (ptrdiff_t)y * dst->linesize[1];
+        uint8_t* v = dst->data[2] + (ptrdiff_t)y * dst->linesize[2];
+        for (int x = 0; x < cw; x++){
+            u[x] = s[2 * x + U_OFF];
+            v[x] = s[2 * x + 1 - U_OFF];
+        }
+    }
+}
+
+// 一个样本转为S16, 浮点样本与swr一样按32768缩放并饱和
+inline int16_t sample_to_s16(int16_t s){ return s; }
+inline int16_t sample_to_s16(float s){
+    float v = std::min(std::max(s * 32768.0f, -32768.0f), 32767.0f);
+    return (int16_t)std::lrintf(v);
+}
+
+// 样本类型S, 是否平面存储, 声道数CH都是编译期常量, 内层循环可以展开
+template <typename S, bool PLANAR, int CH>
+int audio_to_s16(const AVFrame* src, uint8_t* dst){
+    int16_t* out = (int16_t*)dst;
+    int n = src->nb_samples;
+    for (int i = 0; i < n; i++){
+        for (int c = 0; c < CH; c++){
+            S s = PLANAR ? ((const S*)src->data[c])[i] : ((const S*)src->data[0])[i * CH + c];
+            out[i * CH + c] = sample_to_s16(s);
+        }
+    }
+    return n * CH * (int)sizeof(int16_t);
+}
+
+template <int CH>
+AudioConvertFunc select_audio_convert_ch(AVSampleFormat fmt){
+    switch (fmt){
+    case AV_SAMPLE_FMT_S16:  return audio_to_s16<int16_t, false, CH>;
+    case AV_SAMPLE_FMT_S16P: return audio_to_s16<int16_t, true, CH>;
+    case AV_SAMPLE_FMT_FLT:  return audio_to_s16<float, false, CH>;
+    case AV_SAMPLE_FMT_FLTP: return audio_to_s16<float, true, CH>;
+    default: return nullptr;
+    }
+}
+
+} // namespace av_convert
+
+// 按源像素格式选择视频转换函数, 没有特化时返回nullptr
+inline VideoConvertFunc select_video_convert(AVPixelFormat fmt){
+    switch (fmt){
+    case AV_PIX_FMT_YUV420P: return av_convert::yuv420p_copy;
+    // YUVJ420P是全范围(0-255), 输出是有限范围, 需要sws_scale做范围转换, 不能直接复制
+    case AV_PIX_FMT_NV12: return av_convert::nv_to_yuv420p<0>;
+    case AV_PIX_FMT_NV21: return av_convert::nv_to_yuv420p<1>;
+    default: return nullptr;
+    }
+}
+
+// 按源样本格式和声道数选择音频转换函数(只特化单声道和立体声), 没有特化时返回nullptr
+inline AudioConvertFunc select_audio_convert(AVSampleFormat fmt, int channels){
+    switch (channels){
+    case 1: return av_convert::select_audio_convert_ch<1>(fmt);
+    case 2: return av_convert::select_audio_convert_ch<2>(fmt);
+    default: return nullptr;
+    }
+}
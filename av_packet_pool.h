@@ -0,0 +1,48 @@
+/* AVPacket结构体池: 解复用线程取出, 解码线程用完后unref放回, 稳态播放时不再分配/释放AVPacket
+   (payload由av_read_frame在demuxer内部分配, 不经过这里) */
+#pragma once
+#include <mutex>
+#include <vector>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+class AvPacketPool{
+private:
+    std::mutex mtx;
+    std::vector<AVPacket*> free_list;   // 空闲的packet, 都已unref
+    const std::size_t max_free;         // 最多保留的空闲packet数, 超过时释放, 突发之后内存可以回落
+public:
+    AvPacketPool(std::size_t max_free = 512): max_free(max_free){}
+    AvPacketPool(const AvPacketPool&) = delete;
+    AvPacketPool& operator=(const AvPacketPool&) = delete;
+    ~AvPacketPool(){
+        for (AVPacket* pkt: this->free_list){
+            av_packet_free(&pkt);
+        }
+    }
+    // 取出一个空packet, 池为空时返回nullptr, 由调用者分配
+    AVPacket* take(){
+        std::lock_guard<std::mutex> lock(this->mtx);
+        if (this->free_list.empty()){
+            return nullptr;
+        }
+        AVPacket* pkt = this->free_list.back();
+        this->free_list.pop_back();
+        return pkt;
+    }
+    // 释放payload引用后放回
+    void put(AVPacket* pkt){
+        av_packet_unref(pkt);
+        {
+            std::lock_guard<std::mutex> lock(this->mtx);
+            if (this->free_list.size() < this->max_free){
+                this->free_list.push_back(pkt);
+                return;
+            }
+        }
+        av_packet_free(&pkt);
+    }
+};
@@ -0,0 +1,142 @@
+#include "av_pool.h"
+#include "av_trace.h"
+
+extern "C"
+{
+#include <libavutil/log.h>
+}
+
+AvTaskPool::AvTaskPool(int n_threads){
+    if (n_threads <= 0){
+        n_threads = SDL_GetCPUCount();
+    }
+    for (int i = 0; i < n_threads; i++){
+        Worker* w = new Worker();
+        w->pool = this;
+        w->id = i;
+        this->workers.push_back(w);
+    }
+    // 所有Worker创建完再启动线程, 窃取时会访问其他Worker
+    for (Worker* w: this->workers){
+        w->tid = SDL_CreateThread(worker_thread, "pool_worker", w);
+        if (!w->tid){
+            av_log(nullptr, AV_LOG_ERROR, "SDL_CreateThread pool_worker %d failed\n", w->id);
+        }
+    }
+}
+
+AvTaskPool::~AvTaskPool(){
+    this->stop();
+    for (Worker* w: this->workers){
+        delete w;
+    }
+}
+
+void AvTaskPool::stop(){
+    this->quit = 1;
+    {
+        std::lock_guard<std::mutex> lock(this->idle_mtx);
+        this->idle_cv.notify_all();
+    }
+    for (Worker* w: this->workers){
+        SDL_WaitThread(w->tid, nullptr);
+        w->tid = nullptr;
+    }
+}
+
+void AvTaskPool::add(AvPoolTask* task){
+    Worker* w = this->workers[this->next_worker++ % this->workers.size()];
+    std::lock_guard<std::mutex> lock(w->mtx);
+    w->q[task->priority > 0 ? 1 : 0].push_back(task);
+    this->live_tasks++;
+    this->wake();
+}
+
+AvPoolTask* AvTaskPool::take(int id){
+    int n = this->workers.size();
+    for (int level = 1; level >= 0; level--){
+        // 1. 本线程队头
+        {
+            Worker* w = this->workers[id];
+            std::lock_guard<std::mutex> lock(w->mtx);
+            if (!w->q[level].empty()){
+                AvPoolTask* task = w->q[level].front();
+                w->q[level].pop_front();
+                return task;
+            }
+        }
+        // 2. 窃取其他线程队尾
+        for (int i = 1; i < n; i++){
+            Worker* w = this->workers[(id + i) % n];
+            std::lock_guard<std::mutex> lock(w->mtx);
+            if (!w->q[level].empty()){
+                AvPoolTask* task = w->q[level].back();
+                w->q[level].pop_back();
+                this->steals++;
+                return task;
+            }
+        }
+    }
+    return nullptr;
+}
+
+// 只有有进展的高优先级任务放回高优先级队列, 否则空转的高优先级任务会饿死其他流
+void AvTaskPool::put(int id, AvPoolTask* task, int progress){
+    Worker* w = this->workers[id];
+    std::lock_guard<std::mutex> lock(w->mtx);
+    w->q[(progress > 0 && task->priority > 0) ? 1 : 0].push_back(task);
+}
+
+// 等待超时1ms: 输出任务的进展取决于时间流逝(帧到显示时间), 没有其他线程会唤醒
+void AvTaskPool::idle_wait(int64_t seen){
+    std::unique_lock<std::mutex> lock(this->idle_mtx);
+    this->idle_sleeps++;
+    this->sleepers++;
+    this->idle_cv.wait_for(lock, std::chrono::milliseconds(1),
+        [&]{ return this->quit || this->progress_seq != seen; });
+    this->sleepers--;
+}
+
+// 先增加序号再检查等待者: 等待者先增加sleepers再检查序号, 两者至少有一个能看到对方, 不会丢失唤醒
+void AvTaskPool::wake(){
+    this->progress_seq++;
+    if (this->sleepers > 0){
+        std::lock_guard<std::mutex> lock(this->idle_mtx);
+        this->idle_cv.notify_all();
+    }
+}
+
+int AvTaskPool::run(int id){
+    int misses = 0;     // 连续无进展的步数
+    AV_TRACE_THREAD("pool_worker");
+    while (!this->quit){
+        int64_t seen = this->progress_seq;
+        AvPoolTask* task = this->take(id);
+        if (!task){     // 任务都在其他线程上执行
+            this->idle_wait(seen);
+            continue;
+        }
+        int ret = task->run_step();
+        this->steps++;
+        if (ret < 0){   // 任务结束, 不再调度
+            this->live_tasks--;
+            continue;
+        }
+        this->put(id, task, ret);
+        if (ret > 0)    // 有进展时(如解码出帧)其他任务可能也可以继续了
+            this->wake();
+        // 轮询了一遍所有任务都没有进展时等待, 避免空转占满CPU
+        misses = ret > 0 ? 0 : misses + 1;
+        if (misses > this->live_tasks){
+            this->idle_wait(seen);
+            misses = 0;
+        }
+    }
+    return 0;
+}
+
+void AvTaskPool::report(){
+    av_log(nullptr, AV_LOG_INFO, "[stats] pool: %d threads, %d tasks, steps %lld, steals %lld, idle sleeps %lld\n",
+        this->size(), this->tasks(), (long long)this->steps.load(), (long long)this->steals.load(),
+        (long long)this->idle_sleeps.load());
+}
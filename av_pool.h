@@ -0,0 +1,64 @@
+/* 多路流共享的工作窃取线程池, 调度解复用/解码/输出等小步任务 */
+#pragma once
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+extern "C"
+{
+#include <SDL2/SDL.h>
+}
+
+// 可被线程池调度的任务, 同一时刻只会被一个工作线程执行
+class AvPoolTask{
+public:
+    virtual ~AvPoolTask(){}
+    virtual int run_step() = 0;     // 执行一小步, >0有进展, 0暂时无事可做, <0结束(不再调度)
+    std::atomic<int> priority{0};   // >0为高优先级(如需要优先保证的流), 有进展时优先调度
+};
+
+class AvTaskPool{
+private:
+    struct Worker{
+        std::deque<AvPoolTask*> q[2];   // 任务队列, [0]普通优先级, [1]高优先级
+        std::mutex mtx;
+        SDL_Thread* tid = nullptr;
+        AvTaskPool* pool;
+        int id;
+    };
+    std::vector<Worker*> workers;
+    std::atomic<int> quit{0};
+    std::atomic<int> next_worker{0};    // 新任务轮流分配给各工作线程
+    std::atomic<int> live_tasks{0};     // 还在调度的任务数
+    // 空闲等待: 没有任务可取或所有任务都无事可做时在条件变量上等待, 任务有进展时唤醒
+    std::mutex idle_mtx;
+    std::condition_variable idle_cv;
+    std::atomic<int64_t> progress_seq{0};   // 有进展的步数序号, 等待期间变化即唤醒
+    std::atomic<int> sleepers{0};           // 正在等待的工作线程数
+    // 统计
+    std::atomic<int64_t> steps{0};      // 执行的步数
+    std::atomic<int64_t> steals{0};     // 从其他线程窃取任务的次数
+    std::atomic<int64_t> idle_sleeps{0};    // 没有任务可取或所有任务都无事可做时的等待次数
+    static int worker_thread(void* data){
+        Worker* w = (Worker*)data;
+        return w->pool->run(w->id);
+    }
+    int run(int id);                    // 工作线程主体
+    AvPoolTask* take(int id);           // 取任务: 先高优先级, 先本线程队头, 再窃取其他线程队尾
+    void put(int id, AvPoolTask* task, int progress);  // 放回本线程队尾, 轮转保证各路流公平
+    void idle_wait(int64_t seen);       // 等到有任务取得进展(序号不再是seen)、退出或超时
+    void wake();                        // 记录一次进展, 唤醒等待的工作线程
+public:
+    AvTaskPool(int n_threads);
+    ~AvTaskPool();
+    AvTaskPool(const AvTaskPool&) = delete;
+    AvTaskPool& operator=(const AvTaskPool&) = delete;
+    void add(AvPoolTask* task);         // 添加任务, 任务由调用者释放, 释放前需先stop()
+    void stop();                        // 停止并等待所有工作线程退出
+    int size(){ return (int)this->workers.size(); }
+    int tasks(){ return this->live_tasks; }
+    void report();                      // 打印统计信息
+};
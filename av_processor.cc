@@ -7,14 +7,33 @@ extern "C"
 #include <SDL2/SDL.h>
 }
 
-#define MAX_AUDIO_FRAME_SIZE 192000
 #define MAX_AUDIO_FRAME_READ_ONCE 5
 
 // [ ] TODO: src输入其实不太好
-AvProcessor::AvProcessor(const char *src){
+// codec_threads为解码器线程数, 0为FFmpeg自动选择; 多路流共享线程池时设为1, 避免和线程池争抢CPU
+AvProcessor::AvProcessor(const char *src, int codec_threads, int fast_convert, double live_target){
     int ret;
-    // 1. 打开输入视频文件
-    ret = avformat_open_input(&(this->fmt_ctx), src, nullptr, nullptr);
+    static std::atomic<int> instances{0};
+    this->instance = instances++;
+    // 1. 打开输入视频文件, 直播模式下不缓冲探测数据, 本地文件读到结尾时等待新数据(file协议的follow选项)
+    this->live = live_target > 0;
+    this->live_target = live_target;
+    this->stats.live_target = (int64_t)(live_target * 1000000);
+    AVDictionary *opts = nullptr;
+    if (this->live){
+        this->fmt_ctx = avformat_alloc_context();
+        if (!this->fmt_ctx){
+            av_log(nullptr, AV_LOG_ERROR, "avformat_alloc_context failed\n");
+            this->invalid = OPEN_INPUT_FAILED;
+            return;
+        }
+        this->fmt_ctx->interrupt_callback.callback = interrupt_cb;
+        this->fmt_ctx->interrupt_callback.opaque = this;
+        this->fmt_ctx->flags |= AVFMT_FLAG_NOBUFFER;
+        av_dict_set(&opts, "follow", "1", 0);
+    }
+    ret = avformat_open_input(&(this->fmt_ctx), src, nullptr, &opts);
+    av_dict_free(&opts);
     if (ret < 0){
         av_log(nullptr, AV_LOG_ERROR, "open input failed\n");
         this->invalid = OPEN_INPUT_FAILED;
@@ -27,67 +46,81 @@ AvProcessor::AvProcessor(const char *src){
         return;
     }
 
-    // 3. 从输入文件中获取流stream，v_index为视频流索引，a_index为音频流索引
+    // 3. 从输入文件中获取流stream，v_index为视频流索引，a_index为音频流索引, 允许只有其中一种流
     this->v_index = av_find_best_stream(this->fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
     if (this->v_index < 0){
-        av_log(nullptr, AV_LOG_ERROR, "finding best stream failed\n");
-        this->invalid = FIND_BEST_V_STREAM_FAILED;
-        return;
+        av_log(nullptr, AV_LOG_INFO, "no video stream, audio-only mode\n");
     }
     this->a_index = av_find_best_stream(this->fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
-    if (this->a_index < 0)
-    {
+    if (this->a_index < 0){
+        av_log(nullptr, AV_LOG_INFO, "no audio stream, video-only mode\n");
+    }
+    if (this->v_index < 0 && this->a_index < 0){
         av_log(nullptr, AV_LOG_ERROR, "finding best stream failed\n");
-        this->invalid = FIND_BEST_A_STREAM_FAILED;
+        this->invalid = FIND_BEST_STREAM_FAILED;
         return;
     }
 
     // 4. 查找视频、音频流对应的编码器并分配上下文
-    this->v_codec = avcodec_find_decoder(this->fmt_ctx->streams[this->v_index]->codecpar->codec_id);
-    if (!this->v_codec){
-        av_log(nullptr, AV_LOG_ERROR, "avcodec_find_decoder failed\n");
-        this->invalid = V_CODEC_NOT_FOUND;
-        return;
+    if (this->has_video()){
+        this->v_codec = avcodec_find_decoder(this->fmt_ctx->streams[this->v_index]->codecpar->codec_id);
+        if (!this->v_codec){
+            av_log(nullptr, AV_LOG_ERROR, "avcodec_find_decoder failed\n");
+            this->invalid = V_CODEC_NOT_FOUND;
+            return;
+        }
+        this->v_codec_ctx = avcodec_alloc_context3(this->v_codec);
     }
-    this->v_codec_ctx = avcodec_alloc_context3(this->v_codec);
 
-    this->a_codec = avcodec_find_decoder(this->fmt_ctx->streams[this->a_index]->codecpar->codec_id);
-    if (!this->a_codec){
-        av_log(nullptr, AV_LOG_ERROR, "avcodec_find_decoder failed\n");
-        this->invalid = A_CODEC_NOT_FOUND;
-        return;
+    if (this->has_audio()){
+        this->a_codec = avcodec_find_decoder(this->fmt_ctx->streams[this->a_index]->codecpar->codec_id);
+        if (!this->a_codec){
+            av_log(nullptr, AV_LOG_ERROR, "avcodec_find_decoder failed\n");
+            this->invalid = A_CODEC_NOT_FOUND;
+            return;
+        }
+        this->a_codec_ctx = avcodec_alloc_context3(this->a_codec);
     }
-    this->a_codec_ctx = avcodec_alloc_context3(this->a_codec);
 
     // 5. 读取视频、音频流参数到编码器上下文, 打开编码器
-    ret = avcodec_parameters_to_context(this->v_codec_ctx, this->fmt_ctx->streams[this->v_index]->codecpar);
-    if (ret < 0){
-        av_log(nullptr, AV_LOG_ERROR, "avcodec_parameters_to_context failed\n");
-        this->invalid = READ_V_PARA_FAILED;
-        return;
-    }
+    if (this->has_video()){
+        ret = avcodec_parameters_to_context(this->v_codec_ctx, this->fmt_ctx->streams[this->v_index]->codecpar);
+        if (ret < 0){
+            av_log(nullptr, AV_LOG_ERROR, "avcodec_parameters_to_context failed\n");
+            this->invalid = READ_V_PARA_FAILED;
+            return;
+        }
 
-    ret = avcodec_open2(this->v_codec_ctx, this->v_codec, nullptr);
-    if (ret < 0){
-        av_log(nullptr, AV_LOG_ERROR, "video avcodec_open2 failed\n");
-        this->invalid = V_CODEC_OPEN_FAILED;
-        return;
+        this->v_codec_ctx->thread_count = codec_threads;
+        if (this->live)
+            this->v_codec_ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        ret = avcodec_open2(this->v_codec_ctx, this->v_codec, nullptr);
+        if (ret < 0){
+            av_log(nullptr, AV_LOG_ERROR, "video avcodec_open2 failed\n");
+            this->invalid = V_CODEC_OPEN_FAILED;
+            return;
+        }
+        this->h = this->v_codec_ctx->height;
+        this->w = this->v_codec_ctx->width;
+        this->out_w = this->target_w = this->stats.v_out_w = this->w;
+        this->out_h = this->target_h = this->stats.v_out_h = this->h;
     }
-    this->h = this->v_codec_ctx->height;
-    this->w = this->v_codec_ctx->width;
 
-    ret = avcodec_parameters_to_context(this->a_codec_ctx, this->fmt_ctx->streams[this->a_index]->codecpar);
-    if (ret < 0){
-        av_log(nullptr, AV_LOG_ERROR, "avcodec_parameters_to_context failed\n");
-        this->invalid = READ_A_PARA_FAILED;
-        return;
-    }
+    if (this->has_audio()){
+        ret = avcodec_parameters_to_context(this->a_codec_ctx, this->fmt_ctx->streams[this->a_index]->codecpar);
+        if (ret < 0){
+            av_log(nullptr, AV_LOG_ERROR, "avcodec_parameters_to_context failed\n");
+            this->invalid = READ_A_PARA_FAILED;
+            return;
+        }
 
-    ret = avcodec_open2(this->a_codec_ctx, this->a_codec, nullptr);
-    if (ret < 0){
-        av_log(nullptr, AV_LOG_ERROR, "audio avcodec_open2 failed\n");
-        this->invalid = A_CODEC_OPEN_FAILED;
-        return;
+        this->a_codec_ctx->thread_count = codec_threads;
+        ret = avcodec_open2(this->a_codec_ctx, this->a_codec, nullptr);
+        if (ret < 0){
+            av_log(nullptr, AV_LOG_ERROR, "audio avcodec_open2 failed\n");
+            this->invalid = A_CODEC_OPEN_FAILED;
+            return;
+        }
     }
 
     // 6. 初始化包结构以存放读入的packet
@@ -118,15 +151,24 @@ AvProcessor::AvProcessor(const char *src){
         return;
     }
 
-    // 8. 初始化缩放上下文和音频格式转换上下文
-    this->sws_ctx = sws_getContext(this->v_codec_ctx->width, this->v_codec_ctx->height, this->v_codec_ctx->pix_fmt, 
-        this->v_codec_ctx->width, this->v_codec_ctx->height, AV_PIX_FMT_YUV420P, SWS_BICUBIC, nullptr, nullptr, nullptr);
-    if (!this->sws_ctx){
-        av_log(nullptr, AV_LOG_ERROR, "sws_getContext failed\n");
-        this->invalid = SWS_GETCONTEXT_FAILED;
-        return;
+    // 8. 初始化缩放上下文和音频格式转换上下文(只为存在的流创建)
+    if (this->has_video()){
+        this->sws_ctx = sws_getContext(this->v_codec_ctx->width, this->v_codec_ctx->height, this->v_codec_ctx->pix_fmt, 
+            this->v_codec_ctx->width, this->v_codec_ctx->height, AV_PIX_FMT_YUV420P, SWS_BICUBIC, nullptr, nullptr, nullptr);
+        if (!this->sws_ctx){
+            av_log(nullptr, AV_LOG_ERROR, "sws_getContext failed\n");
+            this->invalid = SWS_GETCONTEXT_FAILED;
+            return;
+        }
+        if (fast_convert)
+            this->v_convert = select_video_convert(this->v_codec_ctx->pix_fmt);
+        av_log(nullptr, AV_LOG_INFO, "video convert: %s -> yuv420p, %s\n",
+            av_get_pix_fmt_name(this->v_codec_ctx->pix_fmt), this->v_convert ? "specialized" : "sws_scale");
     }
 
+    if (!this->has_audio()){
+        return;
+    }
     // int64_t channel_layout = av_get_default_channel_layout(this->a_codec_ctx->ch_layout.nb_channels);
     // 音频重采样上下文
     ret = swr_alloc_set_opts2(
@@ -148,6 +190,42 @@ AvProcessor::AvProcessor(const char *src){
         this->invalid = SWR_GETCONTEXT_FAILED;
         return;
     }
+    this->a_out_freq = this->a_codec_ctx->sample_rate;
+    this->a_out_channels = this->a_codec_ctx->ch_layout.nb_channels;
+    // 采样率和声道布局不变, 只转换样本格式, 常见格式用特化的转换
+    if (fast_convert && !this->live)    // 直播追赶时用swr补偿调整速度, 不用特化转换
+        this->a_convert = select_audio_convert(this->a_codec_ctx->sample_fmt, this->a_codec_ctx->ch_layout.nb_channels);
+    av_log(nullptr, AV_LOG_INFO, "audio convert: %s %d channels -> s16, %s\n",
+        av_get_sample_fmt_name(this->a_codec_ctx->sample_fmt), this->a_codec_ctx->ch_layout.nb_channels,
+        this->a_convert ? "specialized" : "swr_convert");
+    // 9. 重采样输出缓冲区
+    this->a_buf = (uint8_t*)av_malloc(MAX_AUDIO_FRAME_SIZE);
+    if (!this->a_buf){
+        av_log(nullptr, AV_LOG_ERROR, "av_malloc failed\n");
+        this->invalid = AV_MALLOC_FAILED;
+        return;
+    }
+}
+
+// seek后放入packet队列的标记包, 解码线程收到后flush解码器并清空输出队列
+static AVPacket flush_pkt;
+// 输入结束时放入packet队列的标记包, 解码线程收到后取出解码器中剩余的帧
+static AVPacket eof_pkt;
+// 解复用和解码线程共享的packet池(多路流也共用一个)
+static AvPacketPool packet_pool;
+
+// 帧池中没有空闲缓冲区时分配新缓冲区, 统计分配次数(稳态播放时不再增长)
+static AVBufferRef* frame_pool_alloc(void* opaque, size_t size){
+    ((AvStats*)opaque)->v_frame_buf_allocs++;
+    return av_buffer_alloc(size);
+}
+
+// 用完的packet放回池中(标记包除外)
+void free_packet(void* packet){
+    AVPacket **pkt = (AVPacket**)packet;
+    if (*pkt && *pkt != &flush_pkt && *pkt != &eof_pkt)
+        packet_pool.put(*pkt);
+    *pkt = nullptr;
 }
 
 // 析构函数, 错误处理和资源释放
@@ -160,7 +238,17 @@ AvProcessor::~AvProcessor(){
     case AVCODEC_SEND_PKT_FAILED:
     case CREAT_DAUDIO_THREAD_FAILED:
     case CREAT_DVIDEO_THREAD_FAILED:
+    case SWS_RESIZE_FAILED:
         this->is_quit = 1;
+        // 释放队列中剩余的packet和帧
+        this->v_pkt_queue.clear((void(*)(void*))free_packet);
+        this->a_pkt_queue.clear((void(*)(void*))free_packet);
+        this->v_frame_queue.clear((void(*)(void*))av_frame_free);
+        free_packet(&this->pending_pkt);
+        av_frame_free(&this->v_pending_frame);
+        av_buffer_pool_uninit(&this->v_frame_pool);     // 还被引用的缓冲区在释放时才真正回收
+        av_buffer_pool_uninit(&this->v_time_pool);
+        av_freep(&this->a_buf);
         swr_free(&this->swr_ctx);
     case SWR_GETCONTEXT_FAILED:
         sws_freeContext(this->sws_ctx);
@@ -181,185 +269,629 @@ AvProcessor::~AvProcessor(){
     case A_CODEC_NOT_FOUND:
         avcodec_free_context(&(this->v_codec_ctx));
     case V_CODEC_NOT_FOUND:
-    case FIND_BEST_A_STREAM_FAILED:
-    case FIND_BEST_V_STREAM_FAILED:
+    case FIND_BEST_STREAM_FAILED:
     case FIND_STREAM_FAILED:
         avformat_close_input(&(this->fmt_ctx));
     case OPEN_INPUT_FAILED:;
     }
 }
 
-void free_packet(void* packet){ av_packet_unref(*(AVPacket**)packet); }
-
 int AvProcessor::demux(){
     if (this->invalid){
         return this->invalid;
     }
-    // 1. 创建视频解码线程和音频解码线程
-    SDL_Thread *video_tid = SDL_CreateThread(decode_video_thread, "decode_video_thread", this);
-    if (!video_tid) {
-        av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread decode_video_thread failed\n");
-        return (this->invalid = CREAT_DVIDEO_THREAD_FAILED);
+    AV_TRACE_THREAD("demux");
+    // 1. 创建视频解码线程和音频解码线程(不存在的流不创建对应线程)
+    SDL_Thread *video_tid = nullptr;
+    SDL_Thread *audio_tid = nullptr;
+    if (this->has_video()){
+        video_tid = SDL_CreateThread(decode_video_thread, "decode_video_thread", this);
+        if (!video_tid) {
+            av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread decode_video_thread failed\n");
+            return (this->invalid = CREAT_DVIDEO_THREAD_FAILED);
+        }
     }
-    SDL_Thread *audio_tid = SDL_CreateThread(decode_audio_thread, "decode_audio_thread", this);
-    if (!audio_tid) {
-        av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread decode_audio_thread failed\n");
-        return (this->invalid = CREAT_DAUDIO_THREAD_FAILED);
+    if (this->has_audio()){
+        audio_tid = SDL_CreateThread(decode_audio_thread, "decode_audio_thread", this);
+        if (!audio_tid) {
+            av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread decode_audio_thread failed\n");
+            return (this->invalid = CREAT_DAUDIO_THREAD_FAILED);
+        }
     }
     // 2. 解复用
     while(1){
         if (this->is_quit){
-            // 等待解码线程退出
-            SDL_WaitThread(video_tid, nullptr);
-            SDL_WaitThread(audio_tid, nullptr);
             break;
         }
         if (this->seek_flag!=0){
-            SDL_PauseAudio(-1); // 暂停音频
-            // 计算时间戳(时基AV_TIME_BASE->对应流的time_base)
-            int64_t seek_pos = av_rescale_q(this->seek_pos, AV_TIME_BASE_Q, this->fmt_ctx->streams[this->v_index]->time_base);
-            // 跳转目标时间戳, av_seek_frame默认同时跳转音视频到目标帧
-            if (av_seek_frame(this->fmt_ctx, this->v_index, seek_pos, (1-this->seek_flag)/2) < 0){  // 快退AVSEEK_FLAG_BACKWARD是1
-                av_log(nullptr, AV_LOG_ERROR, "av_seek_frame failed\n");
-            } else {
-                // 清空队列
-                avcodec_flush_buffers(this->v_codec_ctx);
-                avcodec_flush_buffers(this->a_codec_ctx);
-                this->v_pkt_queue.clear((void(*)(void*))free_packet);
-                this->a_pkt_queue.clear((void(*)(void*))free_packet);
-                this->v_frame_queue.clear((void(*)(void*))av_frame_free);
-                this->audio_chunk.clear();
-                av_log(nullptr, AV_LOG_DEBUG, "aframe queue size: %zu\n", this->audio_chunk.size());
-                av_log(nullptr, AV_LOG_DEBUG, "vpkt size: %d\n", this->v_pkt_queue.size());
-            }
-            // 清空状态位
-            this->set_seek_flag(0, 0);
-            SDL_PauseAudio(0);  // 继续音频
-        }
-        AVPacket *pkt = av_packet_alloc();
-        if (av_read_frame(this->fmt_ctx, pkt) < 0){
-            av_log(nullptr, AV_LOG_ERROR, "av_read_frame failed\n");
-            if(this->fmt_ctx->pb->error == 0) {
-                av_log(nullptr, AV_LOG_ERROR, "this->fmt_ctx->pb->error == 0\n");
-                SDL_Delay(100); /* no error; wait for user input */
-                continue;
-            } else {    // 读完了
-                break;
-            }
-        }else{
-            if (pkt->stream_index == this->v_index){    // 视频流
-                while(!this->v_pkt_queue.try_push(pkt)){    // 防止阻塞造成快进快退被卡住，但轮询性能低
-                    if (this->is_quit) break;
-                    if (this->seek_flag) break;
-                }
-            }else if (pkt->stream_index == this->a_index){  // 音频流
-                while(!this->a_pkt_queue.try_push(pkt)){
-                    if (this->is_quit) break;
-                    if (this->seek_flag) break;
-                }
-            }else{
-                av_log(nullptr, AV_LOG_INFO, "other pkt->pts %d, a %d, v %d\n", pkt->stream_index, this->a_index, this->v_index);
-            }
+            this->seek();
+        }
+        if (this->eof){     // 读到结尾, 等待用户快退或退出
+            SDL_Delay(100);
+            continue;
+        }
+        AVPacket *pkt = nullptr;
+        int ret = this->read_packet(&pkt);
+        if (ret == 0 && this->live){    // 直播: 没有新数据, 清除结尾标记后稍后重试
+            if (this->fmt_ctx->pb)
+                this->fmt_ctx->pb->eof_reached = 0;
+            SDL_Delay(10);
+            continue;
+        }
+        if (ret == 0){
+            /* 读到结尾, 没有错误; 通知解码线程取出剩余帧 */
+            if ((!this->has_video() || this->push_packet(&this->v_pkt_queue, &eof_pkt) == 0)
+                && (!this->has_audio() || this->push_packet(&this->a_pkt_queue, &eof_pkt) == 0))
+                this->eof = 1;
+            continue;
+        }else if (ret < 0){     // 读取出错
+            break;
+        }
+        AvQueue<AVPacket*> *queue = this->packet_queue(pkt);
+        if (queue && this->live && !this->live_update(pkt)){
+            queue = nullptr;
+        }
+        if (!queue || this->push_packet(queue, pkt) < 0){
+            free_packet(&pkt);
         }
     }
+    // 3. 等待解码线程退出(SDL_WaitThread传nullptr时直接返回, 解码线程在stop()后退出)
+    SDL_WaitThread(video_tid, nullptr);
+    SDL_WaitThread(audio_tid, nullptr);
     return 0;
 }
 
+// 执行seek: 跳转到seek_pos, 清空packet队列并通知解码线程flush
+void AvProcessor::seek(){
+    // seek以主流为准: 有视频用视频流, 否则用音频流
+    int seek_index = this->has_video() ? this->v_index : this->a_index;
+    // 计算时间戳(时基AV_TIME_BASE->对应流的time_base)
+    int64_t seek_pos = av_rescale_q(this->seek_pos, AV_TIME_BASE_Q, this->fmt_ctx->streams[seek_index]->time_base);
+    // 跳转目标时间戳, av_seek_frame默认同时跳转音视频到目标帧
+    if (av_seek_frame(this->fmt_ctx, seek_index, seek_pos, (1-this->seek_flag)/2) < 0){  // 快退AVSEEK_FLAG_BACKWARD是1
+        av_log(nullptr, AV_LOG_ERROR, "av_seek_frame failed\n");
+    } else {
+        this->seek_landing_pos = this->seek_pos / (double)AV_TIME_BASE;    // 在放入flush包之前设置, 解码线程flush时取走
+        this->flush_queues();
+        if (!this->has_audio())     // 没有音频时外部时钟直接跳到目标位置
+            this->set_ext_clock(this->seek_pos / (double)AV_TIME_BASE);
+        this->stats.seeks++;
+        av_log(nullptr, AV_LOG_DEBUG, "vpkt size: %d\n", this->v_pkt_queue.size());
+    }
+    // 清空状态位
+    this->set_seek_flag(0, 0);
+}
+
+// 送入packet到解码器(pkt为空时取出剩余帧), cat是trace流事件的类别
+int AvProcessor::send_packet(AVCodecContext* ctx, AVPacket* pkt, [[maybe_unused]] const char* cat){
+    AV_TRACE_SCOPE("avcodec_send_packet");
+    if (pkt)
+        AV_TRACE_FLOW('t', cat, this->flow_id(pkt->stream_index, pkt->stream_index == this->v_index ? this->v_serial : this->a_serial, pkt->pts));
+    return avcodec_send_packet(ctx, pkt);
+}
+
+// 从解码器取出一帧
+int AvProcessor::receive_frame(AVCodecContext* ctx, AVFrame* frame){
+    AV_TRACE_SCOPE("avcodec_receive_frame");
+    return avcodec_receive_frame(ctx, frame);
+}
+
+// 清空packet队列, 再放入flush包: 解码器上下文只在各自解码线程中flush, 避免与解码并发访问
+void AvProcessor::flush_queues(){
+    this->eof = 0;
+    free_packet(&this->pending_pkt);    // 线程池模式下还没放入队列的packet
+    this->eof_pending = 0;
+    this->v_pkt_queue.clear((void(*)(void*))free_packet);
+    this->a_pkt_queue.clear((void(*)(void*))free_packet);
+    this->pkt_serial++;
+    if (this->has_video())
+        this->v_pkt_queue.push(&flush_pkt);
+    if (this->has_audio())
+        this->a_pkt_queue.push(&flush_pkt);
+}
+
+// 直播: 延迟(最新读到的主流packet - 主时钟)超过目标时加速5%, 超过太多时丢弃已缓冲的数据, 从下一个视频关键帧重新开始
+bool AvProcessor::live_update(AVPacket* pkt){
+    // 1. 丢弃后等待视频关键帧, 音频也一起丢弃保持同步
+    if (this->live_wait_key){
+        if (pkt->stream_index != this->v_index || !(pkt->flags & AV_PKT_FLAG_KEY)){
+            return false;
+        }
+        this->live_wait_key = 0;
+    }
+    int master = this->has_audio() ? this->a_index : this->v_index;
+    if (pkt->stream_index != master || pkt->pts == AV_NOPTS_VALUE){
+        return true;
+    }
+    double edge = pkt->pts * av_q2d(this->fmt_ctx->streams[master]->time_base);
+    int64_t now = av_gettime_relative();
+    // 2. 开始播放或丢弃后: 没有音频时外部时钟从这里开始, 等主时钟跟上后再调整
+    if (this->live_rebase){
+        if (!this->has_audio())
+            this->set_ext_clock(edge);
+        this->live_rebase = 0;
+        this->live_hold_until = now + (int64_t)(std::max(1.0, 2 * this->live_target) * 1000000);
+    }
+    if (now < this->live_hold_until){
+        return true;
+    }
+    double latency = edge - this->get_master_clock();
+    int64_t us = (int64_t)(latency * 1000000);
+    this->stats.live_latency_last = us;
+    this->stats.live_latency.add(us);
+    AvStats::update_max(this->stats.live_latency_max, us);
+    // 3. 超过目标太多: 丢弃已缓冲的数据(音频不能加速时超过目标0.5s就丢弃)
+    double drop_at = this->a_speed_failed ? this->live_target + 0.5 : std::max(2 * this->live_target, this->live_target + 0.5);
+    if (latency > drop_at){
+        av_log(nullptr, AV_LOG_INFO, "live: latency %.2f s, dropping buffered data\n", latency);
+        this->flush_queues();
+        this->set_speed(1.0);
+        this->live_wait_key = this->has_video();
+        this->live_rebase = 1;
+        this->stats.live_drops++;
+        return !this->live_wait_key;    // 没有视频时从下一个音频packet开始
+    }
+    // 4. 超过目标: 加速播放, 回到目标内恢复正常速度
+    this->set_speed(latency > this->live_target ? 1.05 : 1.0);
+    return true;
+}
+
+// 主时钟速度: 有音频时由swr补偿改变音频播放速度, 否则改变外部时钟速度.
+// swr补偿失败时不改为加速外部时钟: 音频仍是主时钟, 加速不用的时钟只会让视频和音频错开
+void AvProcessor::set_speed(double speed){
+    if (this->has_audio()){
+        if (this->a_speed_failed)
+            return;
+        if (speed > 1.0 && this->a_speed == 1.0)
+            this->stats.live_speedups++;
+        this->a_speed = speed;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(this->ext_clock_mutex);
+    if (speed == this->ext_clock_speed){
+        return;
+    }
+    if (speed > 1.0)
+        this->stats.live_speedups++;
+    // 保持时钟当前值不变, 只改变之后的走速
+    double t = this->ext_clock_paused_at >= 0 ? this->ext_clock_paused_at : av_gettime_relative() / 1000000.0;
+    double clock = (t - this->ext_clock_base) * this->ext_clock_speed;
+    this->ext_clock_speed = speed;
+    this->ext_clock_base = t - clock / speed;
+}
+
+// 读取一个packet, 返回1为成功, 0为读到结尾, <0为出错
+int AvProcessor::read_packet(AVPacket** out){
+    // 优先复用池中的packet, 池为空时才分配
+    AVPacket *pkt = packet_pool.take();
+    if (!pkt){
+        pkt = av_packet_alloc();
+        if (!pkt){
+            av_log(nullptr, AV_LOG_ERROR, "pkt alloc failed\n");
+            this->invalid = AV_MALLOC_FAILED;
+            return -1;
+        }
+        this->stats.pkt_allocs++;
+    }
+    this->stats.pkt_reads++;
+    AV_TRACE_SCOPE("av_read_frame");
+    if (av_read_frame(this->fmt_ctx, pkt) < 0){
+        free_packet(&pkt);
+        if(!this->fmt_ctx->pb || this->fmt_ctx->pb->error == 0) {
+            if (!this->live)
+                av_log(nullptr, AV_LOG_INFO, "end of input\n");
+            return 0;
+        }
+        av_log(nullptr, AV_LOG_ERROR, "av_read_frame failed\n");
+        return -1;
+    }
+    if (pkt->buf)   // payload缓冲区由demuxer为这个packet新分配, 池只复用AVPacket结构体
+        this->stats.pkt_payload_allocs++;
+    AV_TRACE_FLOW('s', pkt->stream_index == this->v_index ? "video" : "audio", this->flow_id(pkt->stream_index, this->pkt_serial, pkt->pts));
+    *out = pkt;
+    return 1;
+}
+
+// packet对应的packet队列, 不需要的流返回nullptr
+AvQueue<AVPacket*>* AvProcessor::packet_queue(AVPacket* pkt){
+    if (pkt->stream_index == this->v_index){    // 视频流
+        return &this->v_pkt_queue;
+    }else if (pkt->stream_index == this->a_index){  // 音频流
+        return &this->a_pkt_queue;
+    }
+    av_log(nullptr, AV_LOG_DEBUG, "other pkt->stream_index %d, a %d, v %d\n", pkt->stream_index, this->a_index, this->v_index);
+    return nullptr;
+}
+
+// 非阻塞push, 防止阻塞造成快进快退被卡住，但轮询性能低; 退出或seek时放弃并返回-1
+int AvProcessor::push_packet(AvQueue<AVPacket*>* queue, AVPacket* pkt){
+    while(!queue->try_push(pkt)){
+        if (this->is_quit || this->seek_flag){
+            return -1;
+        }
+    }
+    AV_TRACE_INSTANT("pkt_enqueue");
+    return 0;
+}
+
+// seek: flush视频解码器, 丢弃旧位置的帧
+void AvProcessor::flush_video(){
+    avcodec_flush_buffers(this->v_codec_ctx);
+    av_frame_free(&this->v_pending_frame);
+    this->v_frame_queue.clear((void(*)(void*))av_frame_free);
+    this->v_eof_done = 0;
+    // 之后转换的帧都是seek后的帧(直播丢弃数据时也会flush, 此时没有seek目标)
+    this->v_serial++;
+    double target = this->seek_landing_pos.exchange(-1);
+    std::lock_guard<std::mutex> lock(this->seek_mutex);
+    this->seek_landing_target = target;
+    this->seek_landing_serial = this->v_serial;
+}
+
+// seek: flush音频解码器, 丢弃旧位置的PCM数据
+void AvProcessor::flush_audio(){
+    avcodec_flush_buffers(this->a_codec_ctx);
+    this->a_pending_size = 0;
+    this->audio_chunk.clear();
+    this->a_serial++;
+    this->a_eof_done = 0;
+}
+
+// 把解码得到的v_frame转换为YUV420P输出帧, 失败返回nullptr并设置invalid
+AVFrame* AvProcessor::convert_video_frame(){
+    av_log(nullptr, AV_LOG_DEBUG, "frame->pts %lld, frame->best_effort_timestamp %lld\n", this->v_frame->pts, this->v_frame->best_effort_timestamp);
+    if (this->v_frame->pts == AV_NOPTS_VALUE){
+        this->v_frame->pts = this->v_frame->best_effort_timestamp;
+    }
+    AV_TRACE_SCOPE("convert_video_frame");
+    AV_TRACE_FLOW('t', "video", this->flow_id(this->v_index, this->v_serial, this->v_frame->pts));
+    // 1. 分配帧
+    AVFrame *frame = av_frame_alloc();
+    if (!frame){
+        av_log(nullptr, AV_LOG_ERROR, "frame alloc failed\n");
+        this->invalid = V_FRAME_ALLOC_FAILED;
+        return nullptr;
+    }
+    // 2. 输出尺寸变化(窗口缩放)时重建缩放上下文, 缩小用快速双线性插值
+    int tw = this->target_w, th = this->target_h;
+    if (tw != this->out_w || th != this->out_h){
+        int flags = (tw < this->w || th < this->h) ? SWS_FAST_BILINEAR : SWS_BICUBIC;
+        // 参数变化时sws_getCachedContext会释放旧上下文, 失败返回nullptr
+        this->sws_ctx = sws_getCachedContext(this->sws_ctx, this->w, this->h, this->v_codec_ctx->pix_fmt,
+            tw, th, AV_PIX_FMT_YUV420P, flags, nullptr, nullptr, nullptr);
+        if (!this->sws_ctx){
+            av_log(nullptr, AV_LOG_ERROR, "sws_getCachedContext failed\n");
+            av_frame_free(&frame);
+            this->invalid = SWS_RESIZE_FAILED;
+            return nullptr;
+        }
+        this->out_w = tw;
+        this->out_h = th;
+        av_buffer_pool_uninit(&this->v_frame_pool);    // 缓冲区大小随尺寸变化, 下面重建帧池
+        this->stats.v_out_w = tw;
+        this->stats.v_out_h = th;
+        av_log(nullptr, AV_LOG_INFO, "video output size %dx%d -> %dx%d\n", this->w, this->h, tw, th);
+    }
+    if (!this->v_frame_pool){
+        this->v_frame_pool = av_buffer_pool_init2(
+            av_image_get_buffer_size(AV_PIX_FMT_YUV420P, this->out_w, this->out_h, 32), &this->stats, frame_pool_alloc, nullptr);
+        if (!this->v_frame_pool){
+            av_log(nullptr, AV_LOG_ERROR, "av_buffer_pool_init failed\n");
+            av_frame_free(&frame);
+            this->invalid = V_FRAME_ALLOC_FAILED;
+            return nullptr;
+        }
+    }
+    frame->format = AV_PIX_FMT_YUV420P;      // 设置目标像素格式
+    frame->width = this->out_w;              // 设置目标宽度
+    frame->height = this->out_h;             // 设置目标高度
+    frame->pts = this->v_frame->pts;
+    frame->opaque = (void*)(intptr_t)this->v_serial;    // flush序号, 用于识别seek后的第一帧
+    // 从帧池取目标帧缓冲区, 按32字节对齐划分平面
+    frame->buf[0] = av_buffer_pool_get(this->v_frame_pool);
+    if (!frame->buf[0] || av_image_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data,
+            AV_PIX_FMT_YUV420P, frame->width, frame->height, 32) < 0) {
+        av_log(nullptr, AV_LOG_ERROR, "frame buffer alloc failed\n");
+        av_frame_free(&frame);
+        this->invalid = V_FRAME_ALLOC_FAILED;
+        return nullptr;
+    }
+    // 3. 格式转换和缩放, 不缩放且有特化转换时不经过sws_scale
+    int64_t start = av_gettime_relative();
+    if (this->v_convert && this->out_w == this->v_frame->width && this->out_h == this->v_frame->height){
+        this->v_convert(this->v_frame, frame);
+        this->stats.v_convert_fast.add(av_gettime_relative() - start);
+    }else{
+        sws_scale(this->sws_ctx, (const uint8_t* const*)this->v_frame->data, this->v_frame->linesize, 0, 
+            this->v_codec_ctx->height, frame->data, frame->linesize);
+        this->stats.v_convert_sws.add(av_gettime_relative() - start);
+    }
+    // 4. 记录解码完成时间, 用于统计解码到显示的延迟(取不到缓冲区时不统计这一帧)
+    if (!this->v_time_pool)
+        this->v_time_pool = av_buffer_pool_init(sizeof(int64_t), nullptr);
+    if (this->v_time_pool && (frame->opaque_ref = av_buffer_pool_get(this->v_time_pool)))
+        *(int64_t*)frame->opaque_ref->data = av_gettime_relative();
+    this->stats.v_frames_decoded++;
+    return frame;
+}
+
+// 把解码得到的a_frame重采样为S16交错PCM放入a_buf, 返回字节数, <0为出错
+int AvProcessor::convert_audio_frame(){
+    AV_TRACE_SCOPE("convert_audio_frame");
+    AV_TRACE_FLOW('f', "audio", this->flow_id(this->a_index, this->a_serial, this->a_frame->pts));     // PCM放入audio_chunk后不再区分帧, 音频的流到此结束
+    int channels = this->a_out_channels;
+    int max_samples = MAX_AUDIO_FRAME_SIZE / (channels * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16));
+    // 1. 格式转换, 特化转换一次转换整帧, 放不下时交给swr_convert(out_count是a_buf能容纳的每声道样本数)
+    int64_t start = av_gettime_relative();
+    double speed = this->a_speed;
+    if (this->a_convert && this->a_frame->nb_samples <= max_samples && speed == 1.0 && !this->a_compensating){  // 追赶时要经过swr补偿
+        int data_size = this->a_convert(this->a_frame, this->a_buf);
+        this->stats.a_convert_fast.add(av_gettime_relative() - start);
+        this->stats.a_bytes_decoded += data_size;
+        return data_size;
+    }
+    // 直播追赶: 按速度减少输出样本数(swr补偿), 恢复正常速度时取消补偿; 失败时按正常速度输出, 之后不再加速
+    if (speed != 1.0 || this->a_compensating){
+        int out = (int)av_rescale(this->a_frame->nb_samples, this->a_out_freq, this->a_codec_ctx->sample_rate);
+        int ret = swr_set_compensation(this->swr_ctx, speed != 1.0 ? -(int)(out - out / speed) : 0, out);
+        if (ret < 0){
+            av_log(nullptr, AV_LOG_WARNING, "swr_set_compensation failed (%d), live catch-up falls back to dropping buffered data\n", ret);
+            this->a_speed_failed = 1;
+            this->a_speed = 1.0;
+            this->a_compensating = 0;
+        }else{
+            this->a_compensating = speed != 1.0;
+        }
+    }
+    int samples = swr_convert(this->swr_ctx, &this->a_buf, max_samples, (const uint8_t **)this->a_frame->data, this->a_frame->nb_samples);
+    if (samples < 0){
+        av_log(nullptr, AV_LOG_ERROR, "swr_convert failed\n");
+        return samples;
+    }
+    this->stats.a_convert_swr.add(av_gettime_relative() - start);
+    // 2. 计算数据大小
+    int data_size = av_samples_get_buffer_size(nullptr, channels, samples, AV_SAMPLE_FMT_S16, 1);
+    if (data_size < 0){
+        av_log(nullptr, AV_LOG_ERROR, "Failed to calculate data size\n");
+        return data_size;
+    }
+    this->stats.a_bytes_decoded += data_size;
+    return data_size;
+}
+
 int AvProcessor::decode_video(){
     AVPacket *pkt = nullptr;
     AVFrame *frame = nullptr;
+    AV_TRACE_THREAD("decode_video");
     // 视频解码
     while(1){
         if (this->is_quit){
-            return 0;
+            break;
         }
-        // 1. 读取packet
+        // 1. 读取packet(队列停止时返回nullptr)
         pkt = this->v_pkt_queue.pop();
+        if (!pkt){
+            continue;
+        }
+        if (pkt == &flush_pkt){     // seek
+            this->flush_video();
+            continue;
+        }
+        int draining = (pkt == &eof_pkt);   // 输入结束, 发送空包取出解码器中剩余的帧
         // 2. 发送packet到解码器
-        if (avcodec_send_packet(this->v_codec_ctx, pkt)){
+        if (this->send_packet(this->v_codec_ctx, draining ? nullptr : pkt, "video")){
             av_log(nullptr, AV_LOG_ERROR, "avcodec_send_packet failed\n");
+            free_packet(&pkt);
             return (this->invalid = AVCODEC_SEND_PKT_FAILED);
         }
         av_log(nullptr, AV_LOG_DEBUG, "pkt->pts %lld\n", pkt->pts);
-        // 3. 从解码器接收解码后的帧
-        while(avcodec_receive_frame(this->v_codec_ctx, this->v_frame)>=0){
-            av_log(nullptr, AV_LOG_DEBUG, "frame->pts %lld, frame->best_effort_timestamp %lld\n", this->v_frame->pts, this->v_frame->best_effort_timestamp);
-            if (this->v_frame->pts == AV_NOPTS_VALUE){
-                this->v_frame->pts = this->v_frame->best_effort_timestamp;
-            }
-            // 3.1 分配帧
-            frame = av_frame_alloc();
+        // 3. 从解码器接收解码后的帧, 转换后压入帧队列
+        while(this->receive_frame(this->v_codec_ctx, this->v_frame)>=0){
+            frame = this->convert_video_frame();
             if (!frame){
-                av_log(nullptr, AV_LOG_ERROR, "frame alloc failed\n");
-                return (this->invalid = V_FRAME_ALLOC_FAILED);
+                free_packet(&pkt);
+                return this->invalid;
             }
-            frame->format = AV_PIX_FMT_YUV420P;      // 设置目标像素格式
-            frame->width = this->v_codec_ctx->width;         // 设置目标宽度
-            frame->height = this->v_codec_ctx->height;       // 设置目标高度
-            frame->pts = this->v_frame->pts;
-            if (av_frame_get_buffer(frame, 32) < 0) {    // 分配目标帧缓冲区
-                av_log(nullptr, AV_LOG_ERROR, "frame buffer alloc failed\n");
+            if (!this->v_frame_queue.push(frame)){  // 退出时队列已停止, 帧(和它引用的帧池)要在这里释放
                 av_frame_free(&frame);
-                return (this->invalid = V_FRAME_ALLOC_FAILED);
+                break;
             }
-            // 3.2 裁剪黑边
-            sws_scale(this->sws_ctx, (const uint8_t* const*)this->v_frame->data, this->v_frame->linesize, 0, 
-                this->v_codec_ctx->height, frame->data, frame->linesize);
-            // 3.3 压入帧队列
-            v_frame_queue.push(frame);
+            AV_TRACE_INSTANT("frame_enqueue");
         }
-        // 4. 解引用packet
-        av_packet_unref(pkt);
+        // 4. 释放packet
+        if (draining)
+            this->v_eof_done = 1;
+        else
+            free_packet(&pkt);
     }
     return 0;
 }
 
 int AvProcessor::decode_audio(){
     AVPacket *pkt = nullptr;
-    int data_size = 0;
-    uint8_t *buf = (uint8_t*)av_malloc(8192);
-    if (!buf){
-        av_log(nullptr, AV_LOG_ERROR, "av_malloc failed\n");
-        return (this->invalid = AV_MALLOC_FAILED);
-    }
+    AV_TRACE_THREAD("decode_audio");
     // 音频解码
     while(1){
         if (this->is_quit){
-            return 0;
+            break;
         }
-        // 1. 读取packet
+        // 1. 读取packet(队列停止时返回nullptr)
         pkt = this->a_pkt_queue.pop();
-        this->next_pts = pkt->pts;
+        if (!pkt){
+            continue;
+        }
+        if (pkt == &flush_pkt){     // seek
+            this->flush_audio();
+            continue;
+        }
+        int draining = (pkt == &eof_pkt);   // 输入结束, 发送空包取出解码器中剩余的帧
+        if (!draining && pkt->pts != AV_NOPTS_VALUE)
+            this->next_pts = pkt->pts;
         av_log(nullptr, AV_LOG_DEBUG, "a pkt->pts %lld\n", pkt->pts);
         // 2. 发送packet到解码器
-        if (avcodec_send_packet(this->a_codec_ctx, pkt)){
+        if (this->send_packet(this->a_codec_ctx, draining ? nullptr : pkt, "audio")){
             av_log(nullptr, AV_LOG_ERROR, "avcodec_send_packet failed\n");
-            av_free(buf);
+            free_packet(&pkt);
             return (this->invalid = AVCODEC_SEND_PKT_FAILED);
         }
-        // 3. 从解码器接收解码后的帧
-        while(avcodec_receive_frame(this->a_codec_ctx, this->a_frame) >= 0){
-            // 3.1 计算数据大小
-            data_size = av_samples_get_buffer_size(
-                nullptr, this->a_codec_ctx->ch_layout.nb_channels, this->a_frame->nb_samples, AV_SAMPLE_FMT_S16, 1);
-            if (data_size < 0)
-            {
-                av_log(nullptr, AV_LOG_ERROR, "Failed to calculate data size\n");
-                av_free(buf);
-                return (this->invalid = GET_BYTES_FAILED);
+        // 3. 从解码器接收解码后的帧, 重采样后压入音频帧队列
+        while(this->receive_frame(this->a_codec_ctx, this->a_frame) >= 0){
+            int data_size = this->convert_audio_frame();
+            if (data_size < 0){
+                continue;
             }
-            // 3.2 格式转换
-            swr_convert(this->swr_ctx, &buf, MAX_AUDIO_FRAME_SIZE, (const uint8_t **)this->a_frame->data, this->a_frame->nb_samples);
-            // 3.3 压入音频帧队列
-            this->audio_chunk.push(buf, data_size);
+            this->audio_chunk.push(this->a_buf, data_size);
+            AV_TRACE_INSTANT("pcm_enqueue");
+        }
+        // 4. 释放packet
+        if (draining){
+            this->audio_chunk.finish();     // 声卡回调取完剩余数据后不再等待
+            this->a_eof_done = 1;
+        }else{
+            free_packet(&pkt);
         }
-        // 4. 解引用packet
-        av_packet_unref(pkt);
     }
-    av_free(buf);
     return 0;
 }
 
+/* 线程池模式: 每次只做一小步不阻塞的工作, 返回>0为有进展, 0为暂时无事可做(等待数据或队列满), <0为结束 */
+
+// 解复用一步: 处理seek, 或读取一个packet放入队列
+int AvProcessor::demux_step(){
+    if (this->is_quit || this->invalid){
+        return -1;
+    }
+    if (this->seek_flag != 0){
+        this->seek();
+        return 1;
+    }
+    // 1. 先放入上次没放进去的packet
+    if (this->pending_pkt){
+        AvQueue<AVPacket*> *queue = (this->pending_pkt == &eof_pkt) ? 
+            ((this->eof_pending & 1) ? &this->v_pkt_queue : &this->a_pkt_queue) : this->packet_queue(this->pending_pkt);
+        if (!queue->try_push(this->pending_pkt)){
+            return 0;
+        }
+        AV_TRACE_INSTANT("pkt_enqueue");
+        if (this->pending_pkt == &eof_pkt){     // 依次给视频、音频队列放入结束标记
+            this->eof_pending &= this->eof_pending - 1;
+            if (this->eof_pending){
+                return 1;
+            }
+            this->eof = 1;
+        }
+        this->pending_pkt = nullptr;
+        return 1;
+    }
+    if (this->eof){     // 读到结尾, 等待seek或退出
+        return 0;
+    }
+    // 2. 读取packet
+    AVPacket *pkt = nullptr;
+    int ret = this->read_packet(&pkt);
+    if (ret < 0 && this->invalid){  // 分配失败, 输出任务看到invalid后结束
+        return -1;
+    }
+    if (ret <= 0){      // 读到结尾或读取出错(之后的数据读不到了, 同样当作结尾), 通知解码取出剩余帧
+        this->eof_pending = (this->has_video() ? 1 : 0) | (this->has_audio() ? 2 : 0);
+        this->pending_pkt = &eof_pkt;
+        return 1;
+    }
+    if (!this->packet_queue(pkt)){
+        free_packet(&pkt);
+        return 1;
+    }
+    this->pending_pkt = pkt;
+    return 1;
+}
+
+// 视频解码一步: 放入待输出帧, 或从解码器取一帧, 或送入一个packet
+int AvProcessor::decode_video_step(){
+    if (this->is_quit || this->invalid){
+        return -1;
+    }
+    // 1. 先放入上次没放进去的帧
+    if (this->v_pending_frame){
+        if (!this->v_frame_queue.try_push(this->v_pending_frame)){
+            return 0;
+        }
+        AV_TRACE_INSTANT("frame_enqueue");
+        this->v_pending_frame = nullptr;
+        return 1;
+    }
+    // 2. 从解码器取帧并转换
+    int ret = this->receive_frame(this->v_codec_ctx, this->v_frame);
+    if (ret >= 0){
+        this->v_pending_frame = this->convert_video_frame();
+        return this->v_pending_frame ? 1 : -1;
+    }else if (ret == AVERROR_EOF){
+        this->v_eof_done = 1;
+    }
+    // 3. 解码器需要新的packet
+    AVPacket *pkt = nullptr;
+    if (!this->v_pkt_queue.try_pop(pkt)){
+        return 0;
+    }
+    if (pkt == &flush_pkt){
+        this->flush_video();
+        return 1;
+    }
+    if (this->send_packet(this->v_codec_ctx, pkt == &eof_pkt ? nullptr : pkt, "video")){
+        av_log(nullptr, AV_LOG_ERROR, "avcodec_send_packet failed\n");
+        free_packet(&pkt);
+        this->invalid = AVCODEC_SEND_PKT_FAILED;
+        return -1;
+    }
+    free_packet(&pkt);
+    return 1;
+}
+
+// 音频解码一步: 放入待输出PCM, 或从解码器取一帧, 或送入一个packet
+int AvProcessor::decode_audio_step(){
+    if (this->is_quit || this->invalid){
+        return -1;
+    }
+    // 1. 先放入上次没放进去的PCM数据
+    if (this->a_pending_size){
+        if (!this->audio_chunk.try_push(this->a_buf, this->a_pending_size)){
+            return 0;
+        }
+        AV_TRACE_INSTANT("pcm_enqueue");
+        this->a_pending_size = 0;
+        return 1;
+    }
+    // 2. 从解码器取帧并重采样
+    int ret = this->receive_frame(this->a_codec_ctx, this->a_frame);
+    if (ret >= 0){
+        int data_size = this->convert_audio_frame();
+        if (data_size > 0)
+            this->a_pending_size = data_size;
+        return 1;
+    }else if (ret == AVERROR_EOF && !this->a_eof_done){
+        this->audio_chunk.finish();
+        this->a_eof_done = 1;
+    }
+    // 3. 解码器需要新的packet
+    AVPacket *pkt = nullptr;
+    if (!this->a_pkt_queue.try_pop(pkt)){
+        return 0;
+    }
+    if (pkt == &flush_pkt){
+        this->flush_audio();
+        return 1;
+    }
+    if (pkt != &eof_pkt && pkt->pts != AV_NOPTS_VALUE)
+        this->next_pts = pkt->pts;
+    if (this->send_packet(this->a_codec_ctx, pkt == &eof_pkt ? nullptr : pkt, "audio")){
+        av_log(nullptr, AV_LOG_ERROR, "avcodec_send_packet failed\n");
+        free_packet(&pkt);
+        this->invalid = AVCODEC_SEND_PKT_FAILED;
+        return -1;
+    }
+    free_packet(&pkt);
+    return 1;
+}
+
 // 计算视频时钟, 单位为s
 double AvProcessor::get_video_clock(AVFrame* frame){
     return frame->pts*av_q2d(this->fmt_ctx->streams[this->v_index]->time_base);
@@ -367,13 +899,162 @@ double AvProcessor::get_video_clock(AVFrame* frame){
 
 // 计算音频时钟, 单位为s
 double AvProcessor::get_audio_clock(){
-    // 公式: 当前帧实际时间 = pts x time_base - 已解码未播放字节/(channels x 样本位深 x sample_rate)
+    // 公式: 当前帧实际时间 = pts x time_base - 已解码未播放字节/(输出channels x S16位深 x 输出sample_rate)
+    double bytes_per_sec = this->a_out_channels * this->a_out_freq * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
     double audio_clock = this->next_pts * av_q2d(this->fmt_ctx->streams[this->a_index]->time_base); // 下一音频包的pts
-    audio_clock -= (double)(this->audio_chunk.size()) / 
-        (double)(this->a_codec_ctx->ch_layout.nb_channels*this->a_codec_ctx->sample_rate*
-        av_get_bytes_per_sample(this->a_codec_ctx->sample_fmt));
+    audio_clock -= (double)(this->audio_chunk.size()) / bytes_per_sec;
+    // 声卡中还没播放的数据: 回调时有a_latency_bytes, 之后按实时速度播放
+    if (this->a_latency_bytes){
+        std::lock_guard<std::mutex> lock(this->a_clock_mutex);
+        double now = this->a_paused_at >= 0 ? this->a_paused_at : av_gettime_relative() / 1000000.0;
+        audio_clock -= std::max(0., this->a_latency_bytes / bytes_per_sec - (now - this->a_callback_time));
+    }
     return audio_clock;
 }
 
-void AvProcessor::audio_chunk_pop(uint8_t *stream, int len){ this->audio_chunk.pop(stream, len); }
+// 按声卡实际参数重建重采样上下文(在开始播放前调用), 参数与源不同时不能用特化转换
+int AvProcessor::set_audio_output(int freq, int channels, int latency_samples){
+    this->a_latency_bytes = latency_samples * channels * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
+    this->stats.a_dev_freq = freq;
+    this->stats.a_dev_channels = channels;
+    if (freq == this->a_out_freq && channels == this->a_out_channels){
+        return 0;
+    }
+    AVChannelLayout out_layout;
+    av_channel_layout_default(&out_layout, channels);
+    swr_free(&this->swr_ctx);
+    int ret = swr_alloc_set_opts2(&this->swr_ctx, &out_layout, AV_SAMPLE_FMT_S16, freq,
+        &this->a_codec_ctx->ch_layout, this->a_codec_ctx->sample_fmt, this->a_codec_ctx->sample_rate, 0, nullptr);
+    av_channel_layout_uninit(&out_layout);
+    if (ret < 0 || swr_init(this->swr_ctx) < 0){
+        av_log(nullptr, AV_LOG_ERROR, "swr reconfigure to %d Hz %d channels failed\n", freq, channels);
+        swr_free(&this->swr_ctx);
+        return -1;
+    }
+    this->a_convert = nullptr;
+    this->a_out_freq = freq;
+    this->a_out_channels = channels;
+    av_log(nullptr, AV_LOG_INFO, "audio resample: %d Hz %d channels -> %d Hz %d channels\n",
+        this->a_codec_ctx->sample_rate, this->a_codec_ctx->ch_layout.nb_channels, freq, channels);
+    return 0;
+}
+
+void AvProcessor::set_audio_low_latency(int target_bytes){
+    this->a_nonblocking = 1;
+    this->audio_chunk.set_limit(target_bytes);
+}
+
+void AvProcessor::pause_audio_clock(int pause){
+    std::lock_guard<std::mutex> lock(this->a_clock_mutex);
+    double now = av_gettime_relative() / 1000000.0;
+    if (pause && this->a_paused_at < 0){
+        this->a_paused_at = now;
+    }else if (!pause && this->a_paused_at >= 0){
+        this->a_callback_time += now - this->a_paused_at;   // 暂停期间声卡中的数据没有播放
+        this->a_paused_at = -1;
+    }
+}
+
+// 外部时钟(系统时钟), 单位为s, 用于没有音频时作为主时钟
+double AvProcessor::get_ext_clock(){
+    std::lock_guard<std::mutex> lock(this->ext_clock_mutex);
+    if (this->ext_clock_paused_at >= 0){     // 暂停时时钟停在暂停时刻
+        return (this->ext_clock_paused_at - this->ext_clock_base) * this->ext_clock_speed;
+    }
+    return (av_gettime_relative() / 1000000.0 - this->ext_clock_base) * this->ext_clock_speed;
+}
+
+// 设置外部时钟当前值为pts(s)
+void AvProcessor::set_ext_clock(double pts){
+    std::lock_guard<std::mutex> lock(this->ext_clock_mutex);
+    double now = av_gettime_relative() / 1000000.0;
+    this->ext_clock_base = now - pts / this->ext_clock_speed;
+    if (this->ext_clock_paused_at >= 0){
+        this->ext_clock_paused_at = now;
+    }
+}
+
+// 暂停/继续外部时钟, pause非0为暂停
+void AvProcessor::pause_ext_clock(int pause){
+    std::lock_guard<std::mutex> lock(this->ext_clock_mutex);
+    double now = av_gettime_relative() / 1000000.0;
+    if (pause && this->ext_clock_paused_at < 0){
+        this->ext_clock_paused_at = now;
+    }else if (!pause && this->ext_clock_paused_at >= 0){
+        this->ext_clock_base += now - this->ext_clock_paused_at;  // 暂停的时长不计入时钟
+        this->ext_clock_paused_at = -1;
+    }
+}
+
+// 主时钟: 有音频同步到音频, 否则同步到外部时钟
+double AvProcessor::get_master_clock(){
+    return this->has_audio() ? this->get_audio_clock() : this->get_ext_clock();
+}
+
+// 根据输出区域大小计算保持宽高比的输出尺寸, 只缩小不放大, 实际重建在解码线程中进行
+void AvProcessor::set_output_size(int w, int h){
+    if (!this->has_video() || w <= 0 || h <= 0){
+        return;
+    }
+    double scale = std::min({(double)w / this->w, (double)h / this->h, 1.0});
+    int tw = std::max(2, (int)(this->w * scale) & ~1);  // YUV420P宽高取偶数
+    int th = std::max(2, (int)(this->h * scale) & ~1);
+    if (scale >= 1.0){  // 不缩放时保持源尺寸
+        tw = this->w;
+        th = this->h;
+    }
+    this->target_w = tw;
+    this->target_h = th;
+}
+
+// 从音频帧队列中取出最多len字节PCM数据, 返回实际取出的字节数(输入结束、已停止或低延迟模式欠载时不足len, 不补静音)
+int AvProcessor::audio_chunk_pop(uint8_t *stream, int len){
+    // 1. 低延迟模式下不等待; 实际取到的数据不够一次回调(输入结束和退出除外)记为欠载, 阻塞模式下等到了数据不算
+    int n = this->a_nonblocking ? this->audio_chunk.try_pop(stream, len) : this->audio_chunk.pop(stream, len);
+    if (n < len && !this->a_eof_done && !this->is_quit)
+        this->stats.a_underruns++;
+    // 2. 记录回调时间, 统计从解码输出到播放出来的延迟(队列中剩余数据 + 声卡缓冲, 声卡缓冲是输出后端给出的估计值)
+    {
+        std::lock_guard<std::mutex> lock(this->a_clock_mutex);
+        this->a_callback_time = av_gettime_relative() / 1000000.0;
+    }
+    double bytes_per_sec = this->a_out_channels * this->a_out_freq * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
+    int64_t latency = (int64_t)((this->audio_chunk.size() + this->a_latency_bytes) / bytes_per_sec * 1000000);
+    this->stats.a_latency.add(latency);
+    AvStats::update_max(this->stats.a_latency_max, latency);
+    return n;
+}
+
+// 丢弃最多len字节PCM数据(没有声卡时按实时速度消耗), 不阻塞
+int AvProcessor::audio_chunk_discard(int len){ return this->audio_chunk.try_pop(nullptr, len); }
+
+// 输入结束且所有解码数据都已取出
+bool AvProcessor::finished(){
+    return this->eof
+        && (!this->has_video() || (this->v_eof_done && this->v_frame_queue.size() == 0))
+        && (!this->has_audio() || (this->a_eof_done && this->audio_chunk.size() == 0));
+}
+// 处理器实例(7位)、流序号(4位)、flush序号(12位)和pts(低40位)组合: 多路流之间、seek前后pts相同的帧不会连成一条流
+int64_t AvProcessor::flow_id(int stream_index, int serial, int64_t pts){
+    if (pts == AV_NOPTS_VALUE)
+        return AV_NOPTS_VALUE;  // 不记录
+    return ((int64_t)(this->instance & 0x7f) << 56) | ((int64_t)(stream_index & 0xf) << 52)
+        | ((int64_t)(serial & 0xfff) << 40) | (pts & 0xffffffffffLL);
+}
+void AvProcessor::add_display_latency(AVFrame* frame){
+    if (!frame->opaque_ref)
+        return;
+    int64_t us = av_gettime_relative() - *(int64_t*)frame->opaque_ref->data;
+    this->stats.v_display_latency.add(us);
+    AvStats::update_max(this->stats.v_display_latency_max, us);
+}
+double AvProcessor::take_seek_landing(AVFrame* frame){
+    std::lock_guard<std::mutex> lock(this->seek_mutex);
+    if (this->seek_landing_target < 0 || (intptr_t)frame->opaque != this->seek_landing_serial)
+        return -1;
+    double target = this->seek_landing_target;
+    this->seek_landing_target = -1;
+    return target;
+}
 AVFrame* AvProcessor::video_frame_pop(){ return this->v_frame_queue.pop(); }
+bool AvProcessor::video_frame_try_pop(AVFrame*& frame){ return this->v_frame_queue.try_pop(frame); }
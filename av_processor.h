@@ -1,6 +1,11 @@
 #pragma once
 #include "av_queue.h"
+#include "av_stats.h"
+#include "av_convert.h"
+#include "av_trace.h"
+#include "av_packet_pool.h"
 #include <algorithm>
+#include <atomic>
 
 extern "C"
 {
@@ -8,6 +13,9 @@ extern "C"
 #include <libswscale/swscale.h>
 #include <libavformat/avformat.h>
 #include <libswresample/swresample.h>
+#include <libavutil/time.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 }
 
 #define MAX_AUDIO_FRAME_SIZE 192000
@@ -17,7 +25,8 @@ private:
     int is_quit = 0;
     AVFormatContext *fmt_ctx = nullptr;
     enum ERRNO{ // 错误码
-        GET_BYTES_FAILED = 1,
+        SWS_RESIZE_FAILED = 1,
+        GET_BYTES_FAILED,
         AV_MALLOC_FAILED,
         AVCODEC_SEND_PKT_FAILED,
         CREAT_DAUDIO_THREAD_FAILED,
@@ -34,8 +43,7 @@ private:
         READ_V_PARA_FAILED,
         A_CODEC_NOT_FOUND,
         V_CODEC_NOT_FOUND,
-        FIND_BEST_A_STREAM_FAILED,
-        FIND_BEST_V_STREAM_FAILED,
+        FIND_BEST_STREAM_FAILED,
         FIND_STREAM_FAILED,
         OPEN_INPUT_FAILED,
     };
@@ -45,27 +53,87 @@ private:
     AVPacket * a_pkt = nullptr;
     AVFrame * a_frame = nullptr;
     struct SwrContext *swr_ctx = nullptr;   // 用于音频格式转换
-    int a_index;
+    AudioConvertFunc a_convert = nullptr;   // 编译期特化的音频转换, 为空时用swr_ctx
+    int a_out_freq = 0, a_out_channels = 0;  // 输出(声卡)的采样率和声道数, 默认与源相同
+    int a_latency_bytes = 0;    // 声卡回调取走数据后到播放出来之间缓冲的字节数
+    int a_nonblocking = 0;      // 低延迟模式: 声卡回调不等待数据, 不足时填充静音
+    double a_callback_time = 0; // 最近一次声卡回调的系统时间, 秒
+    double a_paused_at = -1;    // 音频输出暂停时的系统时间, <0表示未暂停
+    std::mutex a_clock_mutex;
+    int a_index = -1;   // <0表示没有音频流
     AvQueue<AVPacket*> a_pkt_queue{100};    // 音频编码数据包队列
     AvBufferQueue<uint8_t> audio_chunk{MAX_AUDIO_FRAME_SIZE};    // 音频帧队列, 用于存放解码后的PCM数据, 给声卡播放
-    int64_t next_pts; // 下一音频帧的pts, 用于计算当前帧的时间戳
+    int64_t next_pts = 0; // 下一音频帧的pts, 用于计算当前帧的时间戳
+    uint8_t *a_buf = nullptr;   // 重采样输出缓冲区
+    int a_pending_size = 0;     // 线程池模式: a_buf中还没放入audio_chunk的字节数
     // video
-    int h, w;
+    int h = 0, w = 0;
     const AVCodec *v_codec = nullptr;
     AVCodecContext *v_codec_ctx = nullptr;
     AVPacket * v_pkt = nullptr;
     AVFrame * v_frame = nullptr;
-    struct SwsContext *sws_ctx = nullptr;   // 用于视频格式转换
-    int v_index;
+    struct SwsContext *sws_ctx = nullptr;   // 用于视频格式转换和缩放, 只在解码线程中重建
+    VideoConvertFunc v_convert = nullptr;   // 编译期特化的视频转换(只用于不缩放时), 为空时用sws_ctx
+    int out_w = 0, out_h = 0;               // sws_ctx当前的输出尺寸
+    AVBufferPool *v_frame_pool = nullptr;   // 输出帧缓冲区池, 随输出尺寸重建, 帧释放后缓冲区回到池中复用
+    AVBufferPool *v_time_pool = nullptr;    // 输出帧opaque_ref的缓冲区池, 存放解码完成时间(us)
+    std::atomic<int> target_w{0}, target_h{0};  // 期望的输出尺寸(跟随窗口大小, 只缩小不放大)
+    int v_index = -1;   // <0表示没有视频流
     AvQueue<AVPacket*> v_pkt_queue{100};    // 视频编码数据包队列
     AvQueue<AVFrame*> v_frame_queue{100};   // 视频帧队列
+    AVFrame *v_pending_frame = nullptr;     // 线程池模式: 还没放入帧队列的帧
+    // demux
+    AVPacket *pending_pkt = nullptr;        // 线程池模式: 还没放入packet队列的packet
+    int eof_pending = 0;                    // 线程池模式: 还要放入结束标记的队列, 第1位视频, 第2位音频
     // 功能-快进快退
     int64_t seek_pos;   // 快进快退的目标位置，秒 * AV_TIME_BASE
     int seek_flag = 0;  // 0为正常播放, 1为快进, -1为快退
     std::mutex seek_mutex;
+    // seek落点统计: 旧位置的帧在解码线程flush之前还会留在帧队列中, 所以按flush序号识别seek后的第一帧
+    int v_serial = 0;                               // 视频flush序号, 解码线程每次flush加1, 记在输出帧的opaque中
+    int a_serial = 0;                               // 音频flush序号, 只用于trace流事件的id
+    int pkt_serial = 0;                             // 解复用flush序号, 每次放入flush包加1, 之后读到的packet与解码线程flush后的序号一致
+    int instance = 0;                               // 处理器实例序号(多路流时区分各路的trace流事件)
+    std::atomic<double> seek_landing_pos{-1};       // demux执行seek的目标位置(s), flush视频时生效
+    double seek_landing_target = -1;                // 生效的seek目标位置(s), <0表示没有, 由seek_mutex保护
+    int seek_landing_serial = 0;                    // 生效的seek对应的flush序号
+    // 输入结束
+    std::atomic<int> eof{0};            // demux读到结尾
+    std::atomic<int> v_eof_done{0};     // 视频解码器剩余帧已全部取出
+    std::atomic<int> a_eof_done{0};     // 音频解码器剩余帧已全部取出
+    int push_packet(AvQueue<AVPacket*>* queue, AVPacket* pkt);  // demux中非阻塞放入packet
+    void seek();                                    // 执行seek
+    void flush_queues();                            // 清空packet队列并通知解码线程flush
+    int read_packet(AVPacket** out);                // 读取一个packet
+    int send_packet(AVCodecContext* ctx, AVPacket* pkt, const char* cat);  // 送入packet到解码器
+    int receive_frame(AVCodecContext* ctx, AVFrame* frame);                 // 从解码器取出一帧
+    AvQueue<AVPacket*>* packet_queue(AVPacket* pkt);    // packet对应的队列
+    void flush_video();                             // seek后flush视频解码器
+    void flush_audio();                             // seek后flush音频解码器
+    AVFrame* convert_video_frame();                 // 转换解码后的视频帧
+    int convert_audio_frame();                      // 重采样解码后的音频帧
+    // 外部时钟, 没有音频时作为主时钟
+    double ext_clock_base = av_gettime_relative() / 1000000.0;  // 时钟零点对应的系统时间, 秒
+    double ext_clock_paused_at = -1;    // 暂停时的系统时间, <0表示未暂停
+    double ext_clock_speed = 1.0;       // 外部时钟速度, 直播追赶时>1
+    std::mutex ext_clock_mutex;
+    // 直播/增长中的文件输入
+    int live = 0;
+    double live_target = 0;             // 延迟目标(最新读到的数据到正在播放的位置), 秒
+    int64_t live_hold_until = 0;        // 开始播放或丢弃后等主时钟跟上, 这之前不调整(系统时间us)
+    int live_wait_key = 0;              // 丢弃后等待视频关键帧, 之前的packet都丢弃
+    int live_rebase = 1;                // 没有音频时用下一个视频packet重设外部时钟
+    std::atomic<double> a_speed{1.0};   // 音频播放速度(swr补偿), 直播追赶时>1
+    int a_compensating = 0;             // swr补偿是否生效
+    std::atomic<int> a_speed_failed{0}; // swr不支持补偿(swr_set_compensation失败), 之后直播追赶只能丢弃缓冲数据
+    static int interrupt_cb(void* data){ return ((AvProcessor*)data)->is_quit; }    // 退出时打断阻塞的读取
+    bool live_update(AVPacket* pkt);    // 直播: 按延迟目标加速或丢弃, 返回false表示丢弃该packet
+    void set_speed(double speed);       // 设置主时钟的播放速度
 public:
     int invalid = 0;  // 错误处理, 0: valid, >0: invalid
-    AvProcessor(const char *src);
+    AvStats stats;    // 播放统计信息
+    // fast_convert为0时总是用sws/swr转换, live_target>0时为直播模式(跟随增长中的文件/流, 按该延迟目标(s)追赶)
+    AvProcessor(const char *src, int codec_threads = 0, int fast_convert = 1, double live_target = 0);
     ~AvProcessor();
     static int demux_thread(void* data){ // 静态成员函数作为创建线程的入口
         return ((AvProcessor*)data)->demux();
@@ -79,10 +147,35 @@ public:
     int demux();            // 解复用线程主体
     int decode_video();     // 视频解码线程主体
     int decode_audio();     // 音频解码线程主体
+    // 线程池模式(多路流共享线程): 每次执行一小步, >0有进展, 0暂时无事可做, <0结束
+    int demux_step();
+    int decode_video_step();
+    int decode_audio_step();
     double get_video_clock(AVFrame* frame); // 计算视频时钟
     double get_audio_clock();               // 计算音频时钟
-    void audio_chunk_pop(uint8_t *stream, int len); // 从音频帧队列中取出PCM数据
+    double get_ext_clock();                 // 计算外部时钟
+    void set_ext_clock(double pts);         // 设置外部时钟
+    void pause_ext_clock(int pause);        // 暂停/继续外部时钟
+    double get_master_clock();              // 主时钟, 音视频同步的基准
+    int set_audio_output(int freq, int channels, int latency_samples);  // 按声卡实际参数设置重采样输出
+    void set_audio_low_latency(int target_bytes);   // 低延迟模式: audio_chunk保持在目标深度, 回调不阻塞
+    void pause_audio_clock(int pause);      // 声卡暂停/继续时同步音频时钟
+    int audio_chunk_pop(uint8_t *stream, int len);  // 从音频帧队列中取出PCM数据, 返回取出的字节数
+    int audio_chunk_discard(int len);               // 非阻塞丢弃PCM数据
     AVFrame* video_frame_pop();                     // 从视频帧队列中取出视频帧
+    bool video_frame_try_pop(AVFrame*& frame);      // 非阻塞取出视频帧, 队列为空时返回false
+    bool finished();                                // 输入结束且解码数据都已取出
+    double take_seek_landing(AVFrame* frame);       // frame是seek后的第一帧时返回seek目标位置(s)并清除, 否则返回-1
+    void add_display_latency(AVFrame* frame);       // 显示frame时统计它从解码完成到显示的延迟
+    int64_t flow_id(int stream_index, int serial, int64_t pts);     // trace流事件的id
+    int64_t flow_id(AVFrame* frame){ return this->flow_id(this->v_index, (int)(intptr_t)frame->opaque, frame->pts); }  // 输出视频帧的流事件id
+    void set_output_size(int w, int h);             // 设置视频输出区域大小(如窗口可绘制区域)
+    void queue_depths(int* v_pkts, int* a_pkts, int* v_frames, int* a_bytes){  // 各队列当前深度
+        *v_pkts = this->v_pkt_queue.size();
+        *a_pkts = this->a_pkt_queue.size();
+        *v_frames = this->v_frame_queue.size();
+        *a_bytes = (int)this->audio_chunk.size();
+    }
     void stop(){    // 停止线程
         this->is_quit = 1;
         this->a_pkt_queue.stop();
@@ -91,8 +184,12 @@ public:
         this->audio_chunk.stop();
     }
     // 获取private属性值
+    bool has_video(){ return this->v_index >= 0; }
+    bool has_audio(){ return this->a_index >= 0; }
     int get_h(){ return this->h; }
     int get_w(){ return this->w; }
+    AVRational get_video_time_base(){ return this->fmt_ctx->streams[this->v_index]->time_base; }
+    AVRational get_video_frame_rate(){ return av_guess_frame_rate(this->fmt_ctx, this->fmt_ctx->streams[this->v_index], nullptr); }
     int get_channels(){ return this->a_codec_ctx->ch_layout.nb_channels; }
     int get_sample_rate(){ return this->a_codec_ctx->sample_rate; }
     void set_seek_flag(int flag, double pos_time){
@@ -26,9 +26,10 @@ public:
     // 禁用拷贝构造函数和赋值运算符(浅拷贝对于互斥锁和条件变量是不安全的)
     AvQueue(const AvQueue&) = delete;
     AvQueue& operator=(const AvQueue&) = delete;
-    void push(T element);   // 进队
+    bool push(T element);   // 进队, 队列已停止时返回false(元素没有进队, 由调用者释放)
     bool try_push(T element);   // 非阻塞进队
     T pop();                // 出队
+    bool try_pop(T& element);   // 非阻塞出队
     int size(){
         std::lock_guard<std::mutex> lock(this->mtx);
         return this->q.size();
@@ -46,48 +47,64 @@ class AvBufferQueue{
 private:
     T* q;
     const std::size_t q_len;
+    std::size_t q_limit;    // 进队时的目标深度(<=q_len), 队列非空时超过则等待
     std::size_t q_size;
     std::mutex mtx;
     std::condition_variable cv;
     int head;
     int tail;
     int running = 1;
+    int finished = 0;   // 生产者已结束, 不会再有新数据
 public:
     AvBufferQueue(std::size_t q_len=100);
     AvBufferQueue(const AvBufferQueue&) = delete;
     AvBufferQueue& operator=(const AvBufferQueue&) = delete;
     ~AvBufferQueue();
     void push(T* element, std::size_t len);  // 进队
-    void pop(T* element, std::size_t len);   // 出队
+    bool try_push(T* element, std::size_t len);  // 非阻塞进队, 空间不足时返回false
+    std::size_t try_pop(T* element, std::size_t len);   // 非阻塞出队, 返回实际出队元素个数
+    std::size_t pop(T* element, std::size_t len);   // 出队, 返回实际出队元素个数
     std::size_t size(){
         return this->q_size;
     }
+    void set_limit(std::size_t limit){  // 设置目标深度, 0为不限制(只受容量限制)
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->q_limit = (limit == 0 || limit > this->q_len) ? this->q_len : limit;
+        this->cv.notify_all();
+    }
     void stop(){        // 用于外部停止队列的阻塞
         this->running = 0;
         this->cv.notify_all();
     }
+    void finish(){      // 生产者结束, 之后pop不再等待凑够len个元素
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->finished = 1;
+        this->cv.notify_all();
+    }
     void clear(){
         std::lock_guard<std::mutex> lock(this->mtx);
         this->q_size = 0;
         this->head = 0;
         this->tail = 0;
+        this->finished = 0;
         this->cv.notify_all();  // 因为相当于pop all, 还是要唤醒大家
     }
 };
 
-// 入队, 将element放入this->q, 并唤醒等待的线程(this->running=0时不保证正确性)
+// 入队, 将element放入this->q, 并唤醒等待的线程, 队列已停止时返回false
 template <typename T>
-void AvQueue<T>::push(T element){
+bool AvQueue<T>::push(T element){
     std::unique_lock<std::mutex> lock(this->mtx);   // 有cv.wait就可能中途释放，lock_guard不支持中途释放
     while (this->running && this->q.size() >= this->q_len){   // 队列长度大于等于最大长度时等待
         av_log(nullptr, AV_LOG_DEBUG, "queue is full: %zu\n", this->q.size());
         this->cv.wait(lock);
     }
     if (!this->running){
-        return;
+        return false;
     }
     this->q.push(element);
     this->cv.notify_all();
+    return true;
 }
 
 template <typename T>
@@ -118,6 +135,19 @@ T AvQueue<T>::pop(){
     return ret;
 }
 
+// 非阻塞出队, 队列为空或已停止时返回false
+template <typename T>
+bool AvQueue<T>::try_pop(T& element){
+    std::lock_guard<std::mutex> lock(this->mtx);
+    if (!this->running || this->q.empty()){
+        return false;
+    }
+    element = this->q.front();
+    this->q.pop();
+    this->cv.notify_all();
+    return true;
+}
+
 template <typename T>
 void AvQueue<T>::clear(void(*callback)(void*)){
     std::lock_guard<std::mutex> lock(this->mtx);
@@ -137,7 +167,7 @@ void AvQueue<T>::clear(void(*callback)(void*)){
 }
 
 template <typename T>
-AvBufferQueue<T>::AvBufferQueue(std::size_t q_len): q_len(q_len){
+AvBufferQueue<T>::AvBufferQueue(std::size_t q_len): q_len(q_len), q_limit(q_len){
     this->q = new T[this->q_len];
     this->q_size = 0;
     this->head = 0;     // 队列头，左边，指向第一个元素
@@ -153,36 +183,73 @@ AvBufferQueue<T>::~AvBufferQueue(){
 template <typename T>
 void AvBufferQueue<T>::push(T* element, std::size_t len){
     std::unique_lock<std::mutex> lock(this->mtx);
-    while (this->running && this->q_size+len >= this->q_len){
+    while (this->running && (this->q_size+len >= this->q_len || (this->q_size && this->q_size+len > this->q_limit))){
         this->cv.wait(lock);
     }
     if (!this->running){
         return;
     }
-    int l = std::min(len, this->q_len - this->tail);
-    memcpy(this->q + this->tail, element, l);
-    memcpy(this->q, element + l, len - l);
+    std::size_t l = std::min(len, this->q_len - this->tail);
+    memcpy(this->q + this->tail, element, l * sizeof(T));
+    memcpy(this->q, element + l, (len - l) * sizeof(T));
+    this->tail = (this->tail + len) % this->q_len;
+    this->q_size += len;
+    this->cv.notify_all();
+}
+
+template <typename T>
+bool AvBufferQueue<T>::try_push(T* element, std::size_t len){
+    std::lock_guard<std::mutex> lock(this->mtx);
+    if (!this->running || this->q_size+len >= this->q_len || (this->q_size && this->q_size+len > this->q_limit)){
+        return false;
+    }
+    std::size_t l = std::min(len, this->q_len - this->tail);
+    memcpy(this->q + this->tail, element, l * sizeof(T));
+    memcpy(this->q, element + l, (len - l) * sizeof(T));
     this->tail = (this->tail + len) % this->q_len;
     this->q_size += len;
     this->cv.notify_all();
+    return true;
+}
+
+// 非阻塞出队, 最多取出len个元素, element为空则直接抛弃
+template <typename T>
+std::size_t AvBufferQueue<T>::try_pop(T* element, std::size_t len){
+    std::lock_guard<std::mutex> lock(this->mtx);
+    if (!this->running){
+        return 0;
+    }
+    len = std::min(len, this->q_size);
+    std::size_t l = std::min(len, this->q_len - this->head);
+    if (element){
+        memcpy(element, this->q + this->head, l * sizeof(T));
+        memcpy(element + l, this->q, (len - l) * sizeof(T));
+    }
+    this->head = (this->head + len) % this->q_len;
+    this->q_size -= len;
+    this->cv.notify_all();
+    return len;
 }
 
 // 出队, 从this->q pop出len个元素放入element地址, 并唤醒等待的线程(this->running=0时不保证正确性)
+// finish()之后不足len个元素时取出剩余的全部元素
 template <typename T>
-void AvBufferQueue<T>::pop(T* element, std::size_t len){
+std::size_t AvBufferQueue<T>::pop(T* element, std::size_t len){
     std::unique_lock<std::mutex> lock(this->mtx);
-    while (this->running && this->q_size < len){
+    while (this->running && !this->finished && this->q_size < len){
         this->cv.wait(lock);
     }
     if (!this->running){
-        return;
+        return 0;
     }
-    int l = std::min(len, this->q_len - this->head);
+    len = std::min(len, this->q_size);
+    std::size_t l = std::min(len, this->q_len - this->head);
     if (element){
-        memcpy(element, this->q + this->head, l);
-        memcpy(element + l, this->q, len - l);
+        memcpy(element, this->q + this->head, l * sizeof(T));
+        memcpy(element + l, this->q, (len - l) * sizeof(T));
     }   // 如果element为空则直接抛弃
     this->head = (this->head + len) % this->q_len;
     this->q_size -= len;
     this->cv.notify_all();
+    return len;
 }
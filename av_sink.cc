@@ -0,0 +1,290 @@
+#include "av_sink.h"
+#include "av_trace.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+extern "C"
+{
+#include <libavutil/log.h>
+#include <libavutil/time.h>
+}
+
+// 打开文件, "-"代表标准输出
+static std::FILE* open_output(const char* path){
+    if (strcmp(path, "-") == 0){
+        return stdout;
+    }
+    return std::fopen(path, "wb");
+}
+
+static void close_output(std::FILE* fp){
+    if (fp && fp != stdout){
+        std::fclose(fp);
+    }else if (fp){
+        std::fflush(fp);
+    }
+}
+
+/* SDL视频输出 */
+SdlVideoSink::~SdlVideoSink(){
+    if (this->texture)
+        SDL_DestroyTexture(this->texture);
+    if (this->renderer)
+        SDL_DestroyRenderer(this->renderer);
+    if (this->window)
+        SDL_DestroyWindow(this->window);
+    if (this->inited)
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+}
+
+int SdlVideoSink::open(int w, int h){
+    // 1. 初始化SDL视频子系统
+    if (SDL_InitSubSystem(SDL_INIT_VIDEO) < 0){
+        av_log(NULL, AV_LOG_ERROR, "SDL could not initialize video! SDL_Error: %s\n", SDL_GetError());
+        return -1;
+    }
+    this->inited = 1;
+    // 2. 创建窗口
+    this->window = SDL_CreateWindow("basic_AV_Player", SDL_WINDOWPOS_UNDEFINED, 
+        SDL_WINDOWPOS_UNDEFINED, w, h, SDL_WINDOW_RESIZABLE);
+    if (!this->window) {
+        av_log(NULL, AV_LOG_ERROR, "Window could not be created! SDL_Error: %s\n", SDL_GetError());
+        return -1;
+    }
+    // 3. 创建渲染器
+    this->renderer = SDL_CreateRenderer(this->window, -1, 0);
+    if (!this->renderer) {
+        av_log(NULL, AV_LOG_ERROR, "Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
+        return -1;
+    }
+    // 4. 创建纹理
+    this->texture = SDL_CreateTexture(this->renderer, SDL_PIXELFORMAT_IYUV, 
+        SDL_TEXTUREACCESS_STREAMING, w, h);
+    if (!this->texture) {
+        av_log(NULL, AV_LOG_ERROR, "Texture could not be created! SDL_Error: %s\n", SDL_GetError());
+        return -1;
+    }
+    return 0;
+}
+
+int SdlVideoSink::display(AVFrame* frame){
+    // 1. 帧尺寸(跟随窗口缩小)变化时重建纹理
+    int tex_w = 0, tex_h = 0;
+    SDL_QueryTexture(this->texture, nullptr, nullptr, &tex_w, &tex_h);
+    if (tex_w != frame->width || tex_h != frame->height){
+        if (this->texture)
+            SDL_DestroyTexture(this->texture);
+        this->texture = SDL_CreateTexture(this->renderer, SDL_PIXELFORMAT_IYUV, 
+            SDL_TEXTUREACCESS_STREAMING, frame->width, frame->height);
+        if (!this->texture) {
+            av_log(NULL, AV_LOG_ERROR, "Texture could not be created! SDL_Error: %s\n", SDL_GetError());
+            return -1;
+        }
+    }
+    // 2. 更新纹理
+    {
+        AV_TRACE_SCOPE("SDL_UpdateYUVTexture");
+        SDL_UpdateYUVTexture(this->texture, NULL, frame->data[0], frame->linesize[0], 
+            frame->data[1], frame->linesize[1], frame->data[2], frame->linesize[2]);
+    }
+    // 3. 清空渲染器
+    SDL_RenderClear(this->renderer);
+    // 4. 拷贝纹理到渲染器
+    SDL_RenderCopy(this->renderer, this->texture, NULL, NULL);
+    // 5. 显示
+    AV_TRACE_SCOPE("SDL_RenderPresent");
+    SDL_RenderPresent(this->renderer);
+    return 0;
+}
+
+// 可绘制区域大小(高DPI下可能大于窗口大小)
+bool SdlVideoSink::output_size(int* w, int* h){
+    return this->renderer && SDL_GetRendererOutputSize(this->renderer, w, h) == 0;
+}
+
+/* 原始YUV文件输出 */
+FileVideoSink::~FileVideoSink(){
+    close_output(this->fp);
+}
+
+int FileVideoSink::open(int w, int h){
+    this->fp = open_output(this->path);
+    if (!this->fp){
+        av_log(NULL, AV_LOG_ERROR, "open %s failed\n", this->path);
+        return -1;
+    }
+    av_log(NULL, AV_LOG_INFO, "writing yuv420p %dx%d to %s\n", w, h, this->path);
+    return 0;
+}
+
+// 按Y、U、V平面顺序逐行写入, 去掉linesize的对齐填充
+int FileVideoSink::display(AVFrame* frame){
+    for (int plane = 0; plane < 3; plane++){
+        int w = plane ? (frame->width + 1) / 2 : frame->width;
+        int h = plane ? (frame->height + 1) / 2 : frame->height;
+        for (int y = 0; y < h; y++){
+            if (std::fwrite(frame->data[plane] + y * frame->linesize[plane], 1, w, this->fp) != (size_t)w){
+                av_log(NULL, AV_LOG_ERROR, "write %s failed\n", this->path);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* SDL音频输出 */
+SdlAudioSink::~SdlAudioSink(){
+    if (this->dev){
+        SDL_CloseAudioDevice(this->dev);
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    }
+}
+
+// 声卡每次都要拿到len字节, 不足部分(欠载或输入结束)补静音
+void SdlAudioSink::callback(void* data, Uint8* stream, int len){
+    SdlAudioSink* sink = (SdlAudioSink*)data;
+    int n = std::max(0, sink->pull(sink->userdata, stream, len));
+    if (n < len)
+        memset(stream + n, 0, len - n);
+}
+
+int SdlAudioSink::open(AudioParams& params, AudioPullFunc pull, void* userdata){
+    this->pull = pull;
+    this->userdata = userdata;
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0){
+        av_log(NULL, AV_LOG_ERROR, "SDL could not initialize audio! SDL_Error: %s\n", SDL_GetError());
+        return -1;
+    }
+    // 1. 设置参数(回调函数是因为声卡是拉数据而不是我们推给他)
+    SDL_AudioSpec spec, obtained;
+    SDL_zero(spec);
+    spec.freq = params.freq;
+    spec.format = AUDIO_S16SYS;
+    spec.channels = params.channels;
+    spec.silence = 0;
+    spec.samples = params.samples;
+    spec.callback = SdlAudioSink::callback;
+    spec.userdata = this;
+    // 2. 打开音频设备, 采样率和声道数允许设备选择自己支持的值(避免SDL内部再转换), 样本格式固定为S16, 缓冲区大小按配置
+    this->dev = SDL_OpenAudioDevice(NULL, 0, &spec, &obtained,
+        SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+    if (!this->dev){
+        av_log(NULL, AV_LOG_ERROR, "Failed to open audio device, %s\n", SDL_GetError());
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return -1;
+    }
+    // 3. 返回实际参数. SDL2没有查询设备输出延迟的接口, 按双缓冲(SDL缓冲区 + 设备正在播放的一个周期)估计回调之后到播放出来的延迟,
+    //    驱动/硬件的额外缓冲不在其中
+    params.freq = obtained.freq;
+    params.channels = obtained.channels;
+    params.samples = obtained.samples;
+    params.latency_samples = 2 * obtained.samples;
+    av_log(NULL, AV_LOG_INFO, "audio device: %d Hz, %d channels, %d samples buffer\n",
+        obtained.freq, obtained.channels, obtained.samples);
+    return 0;
+}
+
+void SdlAudioSink::pause(int pause_on){
+    SDL_PauseAudioDevice(this->dev, pause_on);
+}
+
+/* 线程模拟声卡的音频输出 */
+ThreadAudioSink::~ThreadAudioSink(){
+    this->close();
+}
+
+int ThreadAudioSink::open(AudioParams& params, AudioPullFunc pull, void* userdata){
+    this->freq = params.freq;
+    this->channels = params.channels;
+    this->samples = params.samples;
+    params.latency_samples = this->realtime ? params.samples : 0;   // 实时模式下拉取的数据在下一周期内"播放"完
+    this->pull = pull;
+    this->userdata = userdata;
+    this->tid = SDL_CreateThread(run_thread, "audio_sink_thread", this);
+    if (!this->tid){
+        av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread audio_sink_thread failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+void ThreadAudioSink::close(){
+    this->quit = 1;
+    SDL_WaitThread(this->tid, nullptr);
+    this->tid = nullptr;
+}
+
+// 像声卡一样每次拉取samples个样本, 实时模式下按采样率计算下次拉取的时间
+// 只写出实际拉取到的数据; 没有数据(输入结束、低延迟模式欠载)时不写静音, 非实时模式下也不空转
+int ThreadAudioSink::run(){
+    int len = this->samples * this->channels * 2;   // S16
+    std::vector<uint8_t> buf(len);
+    int64_t period = (int64_t)this->samples * 1000000 / this->freq;  // 一次拉取的时长, us
+    int64_t next = av_gettime_relative();
+    AV_TRACE_THREAD("audio_sink");
+    while (!this->quit){
+        if (this->paused){
+            SDL_Delay(10);
+            next = av_gettime_relative();
+            continue;
+        }
+        int n = this->pull(this->userdata, buf.data(), len);
+        if (n > 0)          // 先写出已经取出的数据(停止后pull返回0), 退出时不丢失最后一次拉取的数据
+            this->write(buf.data(), n);
+        if (this->quit){
+            break;
+        }
+        if (this->realtime){
+            next += period;
+            int64_t wait = next - av_gettime_relative();
+            if (wait > 0)
+                av_usleep(wait);
+        }else if (n <= 0){  // 等待seek(如循环播放)或退出
+            SDL_Delay(10);
+        }
+    }
+    return 0;
+}
+
+/* 原始PCM文件输出 */
+FileAudioSink::~FileAudioSink(){
+    this->close();  // 先停止线程再关闭文件
+    close_output(this->fp);
+}
+
+int FileAudioSink::open(AudioParams& params, AudioPullFunc pull, void* userdata){
+    this->fp = open_output(this->path);
+    if (!this->fp){
+        av_log(NULL, AV_LOG_ERROR, "open %s failed\n", this->path);
+        return -1;
+    }
+    av_log(NULL, AV_LOG_INFO, "writing s16le %d Hz %d channels to %s\n", params.freq, params.channels, this->path);
+    return ThreadAudioSink::open(params, pull, userdata);
+}
+
+void FileAudioSink::write(const uint8_t* buf, int len){
+    if (std::fwrite(buf, 1, len, this->fp) != (size_t)len){
+        av_log(NULL, AV_LOG_ERROR, "write %s failed\n", this->path);
+    }
+}
+
+VideoSink* create_video_sink(const char* spec){
+    if (strcmp(spec, "sdl") == 0)
+        return new SdlVideoSink();
+    if (strcmp(spec, "null") == 0)
+        return new NullVideoSink();
+    if (strncmp(spec, "yuv:", 4) == 0 && spec[4])
+        return new FileVideoSink(spec + 4);
+    return nullptr;
+}
+
+AudioSink* create_audio_sink(const char* spec, int realtime){
+    if (strcmp(spec, "sdl") == 0)
+        return new SdlAudioSink();
+    if (strcmp(spec, "null") == 0)
+        return new NullAudioSink(realtime);
+    if (strncmp(spec, "pcm:", 4) == 0 && spec[4])
+        return new FileAudioSink(spec + 4, realtime);
+    return nullptr;
+}
@@ -0,0 +1,136 @@
+/* 音视频输出后端: SDL窗口/声卡、空输出(用于基准测试)、原始文件输出(YUV/PCM) */
+#pragma once
+#include <cstdio>
+#include <atomic>
+
+extern "C"
+{
+#include <SDL2/SDL.h>
+#include <libavutil/frame.h>
+}
+
+// 视频输出接口, 输入帧格式为YUV420P
+class VideoSink{
+public:
+    virtual ~VideoSink(){}
+    virtual int open(int w, int h) = 0;             // 打开输出, 0为成功
+    virtual int display(AVFrame* frame) = 0;        // 输出一帧, 不释放帧, 0为成功
+    virtual bool output_size(int* w, int* h){       // 当前输出区域大小(用于缩放), 没有则返回false
+        (void)w; (void)h;
+        return false;
+    }
+    virtual bool interactive(){ return false; }     // 是否实时输出给用户(窗口/声卡), 否则播放完自动退出
+};
+
+// 音频输出参数, open时传入期望值, 返回时为实际值
+struct AudioParams{
+    int freq = 0;
+    int channels = 0;
+    int samples = 0;            // 每次拉取的样本数(声卡缓冲区大小)
+    int latency_samples = 0;    // 拉取后到播放出来之间缓冲的样本数(后端的估计值)
+};
+
+// 拉取最多len字节PCM数据, 返回实际填充的字节数(数据不够时不补静音, 由后端决定怎么处理)
+typedef int (*AudioPullFunc)(void* userdata, uint8_t* stream, int len);
+
+// 音频输出接口, 输出格式为S16交错PCM, 由后端按需调用pull拉取数据
+class AudioSink{
+public:
+    virtual ~AudioSink(){}
+    virtual int open(AudioParams& params, AudioPullFunc pull, void* userdata) = 0;
+    virtual void pause(int pause_on) = 0;           // 非0是暂停, 0是播放
+    virtual bool interactive(){ return false; }
+};
+
+class SdlVideoSink: public VideoSink{
+private:
+    SDL_Window* window = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture* texture = nullptr;
+    int inited = 0;
+public:
+    ~SdlVideoSink();
+    int open(int w, int h) override;
+    int display(AVFrame* frame) override;
+    bool output_size(int* w, int* h) override;
+    bool interactive() override { return true; }
+};
+
+// 丢弃所有帧, 只计数
+class NullVideoSink: public VideoSink{
+public:
+    int open(int w, int h) override { (void)w; (void)h; return 0; }
+    int display(AVFrame* frame) override { (void)frame; return 0; }
+};
+
+// 把帧按平面顺序写入原始YUV420P文件, path为"-"时写到标准输出
+class FileVideoSink: public VideoSink{
+private:
+    std::FILE* fp = nullptr;
+    const char* path;
+public:
+    FileVideoSink(const char* path): path(path){}
+    ~FileVideoSink();
+    int open(int w, int h) override;
+    int display(AVFrame* frame) override;
+};
+
+class SdlAudioSink: public AudioSink{
+private:
+    SDL_AudioDeviceID dev = 0;
+    AudioPullFunc pull = nullptr;
+    void* userdata = nullptr;
+    static void callback(void* data, Uint8* stream, int len);  // 声卡回调, 数据不够时补静音
+public:
+    ~SdlAudioSink();
+    int open(AudioParams& params, AudioPullFunc pull, void* userdata) override;
+    void pause(int pause_on) override;
+    bool interactive() override { return true; }
+};
+
+// 没有声卡时用线程模拟声卡拉取数据, realtime为1时按采样率节奏拉取, 否则尽快拉取; 只输出拉取到的数据, 不补静音
+class ThreadAudioSink: public AudioSink{
+private:
+    SDL_Thread* tid = nullptr;
+    AudioPullFunc pull = nullptr;
+    void* userdata = nullptr;
+    int freq = 0, channels = 0, samples = 0;
+    int realtime;
+    std::atomic<int> paused{1};
+    std::atomic<int> quit{0};
+    static int run_thread(void* data){ return ((ThreadAudioSink*)data)->run(); }
+    int run();
+protected:
+    virtual void write(const uint8_t* buf, int len) = 0;   // 处理拉取到的PCM数据
+public:
+    ThreadAudioSink(int realtime): realtime(realtime){}
+    ~ThreadAudioSink();
+    int open(AudioParams& params, AudioPullFunc pull, void* userdata) override;
+    void pause(int pause_on) override { this->paused = pause_on; }
+    void close();   // 停止拉取线程, 子类析构前调用
+};
+
+class NullAudioSink: public ThreadAudioSink{
+protected:
+    void write(const uint8_t* buf, int len) override { (void)buf; (void)len; }
+public:
+    NullAudioSink(int realtime): ThreadAudioSink(realtime){}
+    ~NullAudioSink(){ this->close(); }
+};
+
+// 把PCM数据写入原始S16文件, path为"-"时写到标准输出
+class FileAudioSink: public ThreadAudioSink{
+private:
+    std::FILE* fp = nullptr;
+    const char* path;
+protected:
+    void write(const uint8_t* buf, int len) override;
+public:
+    FileAudioSink(const char* path, int realtime): ThreadAudioSink(realtime), path(path){}
+    ~FileAudioSink();
+    int open(AudioParams& params, AudioPullFunc pull, void* userdata) override;
+};
+
+// 根据命令行参数创建输出后端: "sdl", "null", "yuv:<file>"/"pcm:<file>", 参数无效返回nullptr
+VideoSink* create_video_sink(const char* spec);
+AudioSink* create_audio_sink(const char* spec, int realtime);
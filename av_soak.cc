@@ -0,0 +1,160 @@
+#include "av_soak.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define AV_ASAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define AV_ASAN 1
+#endif
+#endif
+
+// ASan构建的额外内存余量, KB: 释放的内存先进入隔离区(默认256MB, ASAN_OPTIONS的quarantine_size_mb设置),
+// 填满之前RSS一直增长, 影子内存也随堆增长(堆的1/8), 都不是泄漏
+static int64_t asan_allowance(int64_t rss_base){
+#ifdef AV_ASAN
+    int64_t quarantine_mb = 256;
+    const char* opts = std::getenv("ASAN_OPTIONS");
+    const char* q = opts ? std::strstr(opts, "quarantine_size_mb=") : nullptr;
+    if (q)
+        quarantine_mb = std::atoll(q + std::strlen("quarantine_size_mb="));
+    return quarantine_mb * 1024 + rss_base / 8;
+#else
+    (void)rss_base;
+    return 0;
+#endif
+}
+
+AvSoak::~AvSoak(){
+    if (!this->fp){
+        return;
+    }
+    std::fclose(this->fp);
+    av_log(nullptr, AV_LOG_INFO, "[soak] %s: %.1f s, %d loops, %d samples, max rss growth %lld KB, report %s\n",
+        this->failed ? "FAILED" : "passed", (av_gettime_relative() - this->start_time) / 1000000.0,
+        this->loops, this->samples, (long long)this->rss_max_growth, this->config.report);
+}
+
+int AvSoak::open(){
+    this->fp = std::fopen(this->config.report, "w");
+    if (!this->fp){
+        av_log(nullptr, AV_LOG_ERROR, "open soak report %s failed\n", this->config.report);
+        return -1;
+    }
+    std::fprintf(this->fp, "time_s,loops,rss_kb,rss_growth_kb,pkt_reads,pkt_allocs,pkt_payload_allocs,"
+        "v_frames_decoded,v_frame_buf_allocs,v_frames_displayed,v_frames_dropped,cache_frames,cache_bytes,"
+        "v_pkt_queue,a_pkt_queue,v_frame_queue,audio_chunk_bytes,"
+        "drift_avg_ms,drift_max_ms,frame_p50_ms,frame_p95_ms,frame_p99_ms,"
+        "a_latency_ms,a_underruns\n");
+    this->start_time = av_gettime_relative();
+    this->next_sample = this->start_time + (int64_t)this->config.interval * 1000000;
+    return 0;
+}
+
+// /proc/self/statm第2列是常驻内存页数
+int64_t AvSoak::read_rss(){
+    std::FILE* statm = std::fopen("/proc/self/statm", "r");
+    if (!statm){
+        return -1;
+    }
+    long long size = 0, resident = 0;
+    int n = std::fscanf(statm, "%lld %lld", &size, &resident);
+    std::fclose(statm);
+    if (n != 2){
+        return -1;
+    }
+    return resident * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+// 重新开始计时后的第一帧(开始播放、暂停后、seek后)既不计帧间隔也不计同步误差: 这时主时钟还在和视频对齐
+void AvSoak::on_frame(double delay){
+    int64_t now = av_gettime_relative();
+    int64_t last = this->last_frame;
+    this->last_frame = now;
+    if (!last){
+        return;
+    }
+    this->frame_times.push_back(now - last);
+    int64_t drift = (int64_t)(std::fabs(delay) * 1000000);
+    this->drift_sum += drift;
+    this->drift_count++;
+    this->drift_max = std::max(this->drift_max, drift);
+}
+
+int AvSoak::tick(){
+    int64_t now = av_gettime_relative();
+    if (now < this->next_sample){
+        return 0;
+    }
+    this->next_sample += (int64_t)this->config.interval * 1000000;
+    double elapsed = (now - this->start_time) / 1000000.0;
+    // 1. 帧间隔分位数和同步误差(只统计这个采样间隔)
+    int frames = (int)this->frame_times.size();
+    std::sort(this->frame_times.begin(), this->frame_times.end());
+    auto percentile = [&](int p){
+        return frames ? this->frame_times[std::min(frames - 1, frames * p / 100)] / 1000.0 : 0.;
+    };
+    double drift_avg = this->drift_count ? this->drift_sum / 1000.0 / this->drift_count : 0.;
+    // 2. 预热结束后的第一次采样作为基线: 内存, 这个间隔的同步误差和帧间隔p99
+    int64_t rss = read_rss();
+    int baseline = !this->has_base && elapsed >= this->config.warmup;
+    if (baseline){
+        this->has_base = 1;
+        this->rss_base = rss;
+        this->rss_limit = std::max((int64_t)this->config.max_rss_growth_mb * 1024, rss * this->config.max_rss_growth_pct / 100)
+            + asan_allowance(rss);
+        this->drift_base = drift_avg;
+        this->p99_base = percentile(99);
+        av_log(nullptr, AV_LOG_INFO, "[soak] baseline: rss %lld KB (limit +%lld KB), drift avg %.2f ms, p99 frame time %.2f ms\n",
+            (long long)rss, (long long)this->rss_limit, this->drift_base, this->p99_base);
+    }
+    int64_t growth = (this->rss_base >= 0 && rss >= 0) ? rss - this->rss_base : 0;
+    this->rss_max_growth = std::max(this->rss_max_growth, growth);
+    // 3. 写一行时间序列
+    int v_pkts, a_pkts, v_frames, a_bytes;
+    this->processor->queue_depths(&v_pkts, &a_pkts, &v_frames, &a_bytes);
+    AvStats& stats = this->processor->stats;
+    std::fprintf(this->fp, "%.1f,%d,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%d,%lld,%d,%d,%d,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%lld\n",
+        elapsed, this->loops, (long long)rss, (long long)growth,
+        (long long)stats.pkt_reads.load(), (long long)stats.pkt_allocs.load(), (long long)stats.pkt_payload_allocs.load(),
+        (long long)stats.v_frames_decoded.load(), (long long)stats.v_frame_buf_allocs.load(),
+        (long long)stats.v_frames_displayed.load(), (long long)stats.v_frames_dropped.load(),
+        stats.cache_frames.load(), (long long)stats.cache_bytes.load(), v_pkts, a_pkts, v_frames, a_bytes,
+        drift_avg, this->drift_max / 1000.0, percentile(50), percentile(95), percentile(99),
+        stats.a_latency.avg() / 1000.0, (long long)stats.a_underruns.load());
+    std::fflush(this->fp);
+    this->samples++;
+    // 4. 基线之后检查阈值, 清空这个间隔的统计
+    int ret = (this->has_base && !baseline) ? this->check(growth, drift_avg, percentile(99)) : 0;
+    this->frame_times.clear();
+    this->drift_sum = 0;
+    this->drift_max = 0;
+    this->drift_count = 0;
+    if (ret < 0){
+        return ret;
+    }
+    return (this->config.duration > 0 && elapsed >= this->config.duration) ? 1 : 0;
+}
+
+int AvSoak::check(int64_t growth, double drift_avg, double frame_p99){
+    if (growth > this->rss_limit){
+        av_log(nullptr, AV_LOG_ERROR, "[soak] rss grew %lld KB over baseline (limit %lld KB)\n",
+            (long long)growth, (long long)this->rss_limit);
+        this->failed = 1;
+    }
+    if (drift_avg - this->drift_base > this->config.max_drift_ms){
+        av_log(nullptr, AV_LOG_ERROR, "[soak] average A/V drift %.2f ms, baseline %.2f ms (limit +%d ms)\n",
+            drift_avg, this->drift_base, this->config.max_drift_ms);
+        this->failed = 1;
+    }
+    if (frame_p99 - this->p99_base > this->config.max_frame_ms){
+        av_log(nullptr, AV_LOG_ERROR, "[soak] p99 frame time %.2f ms, baseline %.2f ms (limit +%d ms)\n",
+            frame_p99, this->p99_base, this->config.max_frame_ms);
+        this->failed = 1;
+    }
+    return this->failed ? -1 : 0;
+}
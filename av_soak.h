@@ -0,0 +1,50 @@
+/* 长时间运行测试(soak): 循环播放输入, 按间隔采样内存、分配次数、队列深度、音视频同步误差和帧间隔分位数,
+   写入CSV时间序列; 预热后的第一个采样间隔作为基线, 内存增长或同步误差、帧间隔相对基线变差超过阈值时判定失败 */
+#pragma once
+#include "av_processor.h"
+#include <cstdio>
+#include <vector>
+
+struct SoakConfig{
+    int duration = 0;           // 运行时长(s), 0为一直运行
+    int interval = 10;          // 采样间隔(s)
+    int warmup = 30;            // 预热时长(s), 之后的第一次采样作为基线
+    const char* report = "soak.csv";    // 时间序列报告
+    int max_rss_growth_mb = 32; // 相对基线的常驻内存增长上限, 与下面的比例取较大值(ASan构建另加隔离区和影子内存)
+    int max_rss_growth_pct = 25;    // 相对基线的常驻内存增长比例上限
+    int max_drift_ms = 40;      // 一个采样间隔内音视频同步误差平均值比基线增加的上限
+    int max_frame_ms = 100;     // 一个采样间隔内帧间隔p99比基线增加的上限
+};
+
+class AvSoak{
+private:
+    AvProcessor* processor;
+    SoakConfig config;
+    std::FILE* fp = nullptr;
+    int64_t start_time = 0;         // us
+    int64_t next_sample = 0;        // 下次采样时间, us
+    int has_base = 0;               // 已经取得基线(预热结束)
+    int64_t rss_base = -1;          // 内存基线, KB, 读不到时<0
+    int64_t rss_limit = 0;          // 内存增长上限, KB, 在基线采样时确定
+    int64_t rss_max_growth = 0;     // 最大内存增长, KB
+    double drift_base = 0, p99_base = 0;    // 基线间隔的平均同步误差和帧间隔p99, ms
+    int samples = 0;
+    // 当前采样间隔内的帧统计
+    int64_t last_frame = 0;         // 上一帧显示时间, us, 0表示下一帧重新开始计时
+    std::vector<int64_t> frame_times;   // 帧间隔, us
+    int64_t drift_sum = 0, drift_max = 0;   // 同步误差, us
+    int drift_count = 0;
+    static int64_t read_rss();      // 常驻内存, KB, 失败返回-1
+    int check(int64_t growth, double drift_avg, double frame_p99);  // 检查阈值, 超过返回-1
+public:
+    int loops = 0;      // 已循环次数
+    int failed = 0;     // 超过阈值
+    AvSoak(AvProcessor* processor, const SoakConfig& config): processor(processor), config(config){}
+    ~AvSoak();
+    AvSoak(const AvSoak&) = delete;
+    AvSoak& operator=(const AvSoak&) = delete;
+    int open();                     // 打开报告文件并开始计时, 0为成功
+    void on_frame(double delay);    // 显示一帧, delay为视频与主时钟之差(s)
+    void reset_frame_clock(){ this->last_frame = 0; }  // 暂停/继续、seek(含循环)后调用, 中断的时间不计入帧间隔
+    int tick();                     // 周期调用, 到时间时采样; 返回0继续, 1到达运行时长, -1超过阈值
+};
@@ -0,0 +1,140 @@
+/* 播放统计信息, 各线程更新计数, 按i键或退出时打印 */
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cmath>
+
+extern "C"
+{
+#include <libavutil/log.h>
+#include <libavutil/time.h>
+}
+
+// 耗时统计: 次数和总耗时(us)
+struct AvTiming
+{
+    std::atomic<int64_t> count{0};
+    std::atomic<int64_t> total{0};
+    void add(int64_t us){
+        this->count++;
+        this->total += us;
+    }
+    double avg(){
+        int64_t n = this->count.load();
+        return n ? (double)this->total.load() / n : 0.;
+    }
+};
+
+struct AvStats
+{
+    int64_t start_time = av_gettime_relative();     // 开始统计的时间, us
+    // decode
+    std::atomic<int64_t> v_frames_decoded{0};       // 已解码(转换)视频帧数
+    std::atomic<int64_t> v_frame_buf_allocs{0};     // 帧池新分配输出帧缓冲区的次数
+    std::atomic<int64_t> a_bytes_decoded{0};        // 已解码(重采样)PCM字节数
+    std::atomic<int64_t> pkt_reads{0};              // 读取的packet数
+    std::atomic<int64_t> pkt_allocs{0};             // 其中池为空时新分配AVPacket的次数
+    std::atomic<int64_t> pkt_payload_allocs{0};     // demuxer为packet分配payload缓冲区的次数(不经过池, 稳态时随读包数增长)
+    // convert, 特化转换和FFmpeg通用转换分别统计每帧耗时
+    AvTiming v_convert_fast, v_convert_sws;
+    AvTiming a_convert_fast, a_convert_swr;
+    // video
+    std::atomic<int64_t> v_frames_displayed{0};     // 已显示视频帧数
+    std::atomic<int64_t> v_upload_bytes{0};         // 上传纹理的总字节数
+    std::atomic<int64_t> v_last_upload_bytes{0};    // 最近一帧上传纹理的字节数
+    std::atomic<int> v_out_w{0}, v_out_h{0};        // 当前转换输出(纹理)尺寸
+    std::atomic<int64_t> v_frames_dropped{0};       // 因与主时钟差距过大而丢弃的视频帧数
+    AvTiming v_display_latency;                     // 帧从解码完成到显示的延迟, us
+    std::atomic<int64_t> v_display_latency_max{0};
+    // sync, 单位us
+    std::atomic<int64_t> sync_err_sum{0};           // 显示时视频与主时钟差值绝对值之和
+    std::atomic<int64_t> sync_err_max{0};           // 显示时视频与主时钟差值绝对值最大值
+    std::atomic<int64_t> sync_samples{0};
+    // seek, 单位us
+    std::atomic<int64_t> seeks{0};                  // 成功seek次数
+    std::atomic<int64_t> seek_landings{0};          // 统计到落点误差的次数(seek后显示了第一帧)
+    std::atomic<int64_t> seek_err_last{0};          // 最近一次seek后第一帧与目标位置之差
+    std::atomic<int64_t> seek_err_max{0};           // seek落点误差绝对值最大值
+    // audio output
+    std::atomic<int> a_dev_freq{0}, a_dev_channels{0}, a_dev_samples{0};  // 声卡实际参数
+    std::atomic<int64_t> a_underruns{0};            // 声卡回调实际取到的数据不够的次数(不含输入结束)
+    AvTiming a_latency;                             // 声卡回调时从解码输出到播放出来的延迟(声卡缓冲部分是估计值), us
+    std::atomic<int64_t> a_latency_max{0};
+    // live, 单位us
+    std::atomic<int64_t> live_target{0};            // 直播延迟目标, 0为非直播
+    std::atomic<int64_t> live_latency_last{0};      // 最新读到的数据与正在播放的位置之差
+    std::atomic<int64_t> live_latency_max{0};
+    AvTiming live_latency;
+    std::atomic<int64_t> live_drops{0};             // 超过目标太多时丢弃缓冲数据的次数
+    std::atomic<int64_t> live_speedups{0};          // 开始加速追赶的次数
+    // frame cache
+    std::atomic<int64_t> cache_hits{0};             // 步进/快退由缓存帧满足的次数
+    std::atomic<int64_t> cache_misses{0};           // 缓存中没有目标帧的次数
+    std::atomic<int64_t> cache_bytes{0};            // 缓存帧占用的内存
+    std::atomic<int> cache_frames{0};               // 缓存帧数
+
+    static void update_max(std::atomic<int64_t>& m, int64_t v){
+        int64_t cur = m.load();
+        while (v > cur && !m.compare_exchange_weak(cur, v));
+    }
+    // 记录一次显示时的同步误差, delay单位s
+    void add_sync_error(double delay){
+        int64_t err = (int64_t)(std::fabs(delay) * 1000000);
+        this->sync_err_sum += err;
+        this->sync_samples++;
+        update_max(this->sync_err_max, err);
+    }
+    // 记录一次seek落点误差, err单位s
+    void add_seek_landing(double err){
+        int64_t us = (int64_t)(err * 1000000);
+        this->seek_err_last = us;
+        update_max(this->seek_err_max, std::llabs(us));
+        this->seek_landings++;
+    }
+
+    // 打印统计信息
+    void report(){
+        double elapsed = (av_gettime_relative() - this->start_time) / 1000000.0;
+        av_log(nullptr, AV_LOG_INFO, "[stats] decode: %.1f s, video %lld frames (%.1f fps, %lld frame buffer allocs), audio %lld bytes\n",
+            elapsed, (long long)this->v_frames_decoded.load(),
+            elapsed > 0 ? this->v_frames_decoded.load() / elapsed : 0., (long long)this->v_frame_buf_allocs.load(),
+            (long long)this->a_bytes_decoded.load());
+        av_log(nullptr, AV_LOG_INFO, "[stats] convert: video specialized %lld x %.1f us, sws %lld x %.1f us; "
+            "audio specialized %lld x %.1f us, swr %lld x %.1f us\n",
+            (long long)this->v_convert_fast.count.load(), this->v_convert_fast.avg(),
+            (long long)this->v_convert_sws.count.load(), this->v_convert_sws.avg(),
+            (long long)this->a_convert_fast.count.load(), this->a_convert_fast.avg(),
+            (long long)this->a_convert_swr.count.load(), this->a_convert_swr.avg());
+        int64_t reads = this->pkt_reads.load();
+        av_log(nullptr, AV_LOG_INFO, "[stats] packets: read %lld, AVPacket allocs %lld (%.1f%% reused), payload allocs %lld\n",
+            (long long)reads, (long long)this->pkt_allocs.load(),
+            reads ? 100.0 * (reads - this->pkt_allocs.load()) / reads : 0., (long long)this->pkt_payload_allocs.load());
+        int64_t frames = this->v_frames_displayed.load();
+        av_log(nullptr, AV_LOG_INFO, "[stats] video: %dx%d, frames %lld, upload %lld bytes/frame (avg %lld), "
+            "decode->display avg %.1f ms max %.1f ms\n",
+            this->v_out_w.load(), this->v_out_h.load(), (long long)frames,
+            (long long)this->v_last_upload_bytes.load(),
+            (long long)(frames ? this->v_upload_bytes.load() / frames : 0),
+            this->v_display_latency.avg() / 1000.0, this->v_display_latency_max.load() / 1000.0);
+        int64_t samples = this->sync_samples.load();
+        av_log(nullptr, AV_LOG_INFO, "[stats] sync: avg err %.2f ms, max err %.2f ms, dropped %lld\n",
+            samples ? this->sync_err_sum.load() / 1000.0 / samples : 0., this->sync_err_max.load() / 1000.0,
+            (long long)this->v_frames_dropped.load());
+        av_log(nullptr, AV_LOG_INFO, "[stats] seek: count %lld, last landing err %.2f ms, max %.2f ms\n",
+            (long long)this->seeks.load(), this->seek_err_last.load() / 1000.0, this->seek_err_max.load() / 1000.0);
+        if (this->a_dev_freq.load())
+            av_log(nullptr, AV_LOG_INFO, "[stats] audio: device %d Hz %d ch %d samples, latency (estimated) avg %.1f ms max %.1f ms, underruns %lld\n",
+                this->a_dev_freq.load(), this->a_dev_channels.load(), this->a_dev_samples.load(),
+                this->a_latency.avg() / 1000.0, this->a_latency_max.load() / 1000.0, (long long)this->a_underruns.load());
+        if (this->live_target.load())
+            av_log(nullptr, AV_LOG_INFO, "[stats] live: latency %.0f ms (avg %.0f ms, max %.0f ms, target %.0f ms), speedups %lld, drops %lld\n",
+                this->live_latency_last.load() / 1000.0, this->live_latency.avg() / 1000.0,
+                this->live_latency_max.load() / 1000.0, this->live_target.load() / 1000.0,
+                (long long)this->live_speedups.load(), (long long)this->live_drops.load());
+        int64_t lookups = this->cache_hits.load() + this->cache_misses.load();
+        av_log(nullptr, AV_LOG_INFO, "[stats] cache: %d frames, %.1f MB, hits %lld/%lld (%.1f%%)\n",
+            this->cache_frames.load(), this->cache_bytes.load() / 1048576.0,
+            (long long)this->cache_hits.load(), (long long)lookups,
+            lookups ? 100.0 * this->cache_hits.load() / lookups : 0.);
+    }
+};
@@ -0,0 +1,140 @@
+#include "av_trace.h"
+
+#ifdef AV_TRACE
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <new>
+#include <cstdio>
+
+extern "C"
+{
+#include <libavutil/avutil.h>
+#include <libavutil/log.h>
+}
+
+#define TRACE_CHUNK_EVENTS 4096        // 每块事件数, 线程记录到需要时才分配下一块
+
+struct TraceEvent{
+    const char* name;   // 片段/瞬时事件的名称, 流事件的类别, 都是字符串常量
+    int64_t ts;         // us
+    int64_t arg;        // 片段的持续时间或流事件的id
+    char phase;         // 'X'片段, 'i'瞬时, 's'/'t'/'f'流
+};
+
+static int max_events = 1 << 18;    // 每个线程最多记录的事件数, 写满后丢弃
+
+// 线程私有的事件缓冲区: 只有所属线程写入, 块指针和事件写好后count才用release发布, 写出时读到的事件都已完整
+struct TraceBuffer{
+    int tid;
+    std::atomic<const char*> name{nullptr};
+    std::atomic<int> count{0};
+    std::atomic<int64_t> dropped{0};
+    std::vector<TraceEvent*> chunks;    // 创建时按上限分配好指针数组, 之后大小不变
+    const TraceEvent& at(int i){ return this->chunks[i / TRACE_CHUNK_EVENTS][i % TRACE_CHUNK_EVENTS]; }
+};
+
+// 所有线程的缓冲区, 只在线程第一次记录时加锁注册, 程序结束前不释放(线程可能还在记录)
+static std::mutex buffers_mutex;
+static std::vector<TraceBuffer*> buffers;
+static thread_local TraceBuffer* local_buffer = nullptr;
+
+static TraceBuffer* get_buffer(){
+    if (!local_buffer){
+        local_buffer = new TraceBuffer;
+        local_buffer->chunks.resize((max_events + TRACE_CHUNK_EVENTS - 1) / TRACE_CHUNK_EVENTS, nullptr);
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        local_buffer->tid = (int)buffers.size() + 1;
+        buffers.push_back(local_buffer);
+    }
+    return local_buffer;
+}
+
+static void add_event(const char* name, int64_t ts, int64_t arg, char phase){
+    TraceBuffer* buf = get_buffer();
+    int n = buf->count.load(std::memory_order_relaxed);
+    if (n >= max_events){
+        buf->dropped++;
+        return;
+    }
+    TraceEvent*& chunk = buf->chunks[n / TRACE_CHUNK_EVENTS];
+    if (!chunk){
+        chunk = new (std::nothrow) TraceEvent[TRACE_CHUNK_EVENTS];
+        if (!chunk){
+            buf->dropped++;
+            return;
+        }
+    }
+    chunk[n % TRACE_CHUNK_EVENTS] = {name, ts, arg, phase};
+    buf->count.store(n + 1, std::memory_order_release);
+}
+
+void av_trace_set_limit(int events){
+    if (events > 0)
+        max_events = events;
+}
+
+void av_trace_thread(const char* name){
+    const char* unset = nullptr;
+    get_buffer()->name.compare_exchange_strong(unset, name);
+}
+
+void av_trace_complete(const char* name, int64_t start, int64_t dur){
+    add_event(name, start, dur, 'X');
+}
+
+void av_trace_instant(const char* name){
+    add_event(name, av_gettime_relative(), 0, 'i');
+}
+
+void av_trace_flow(char phase, const char* cat, int64_t id){
+    if (id == AV_NOPTS_VALUE){
+        return;
+    }
+    add_event(cat, av_gettime_relative(), id, phase);
+}
+
+int av_trace_write(const char* path){
+    FILE* fp = fopen(path, "w");
+    if (!fp){
+        av_log(nullptr, AV_LOG_ERROR, "open trace file %s failed\n", path);
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    int total = 0;
+    int64_t dropped = 0;
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (TraceBuffer* buf: buffers){
+        const char* name = buf->name.load();
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            total ? ",\n" : "", buf->tid, name ? name : "thread");
+        total++;
+        int n = buf->count.load(std::memory_order_acquire);
+        for (int i = 0; i < n; i++){
+            const TraceEvent& e = buf->at(i);
+            switch (e.phase){
+            case 'X':
+                fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"av\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+                    e.name, buf->tid, (long long)e.ts, (long long)e.arg);
+                break;
+            case 'i':
+                fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"av\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%lld}",
+                    e.name, buf->tid, (long long)e.ts);
+                break;
+            default:    // 流事件, 绑定到所在的片段; 同一类别(video/audio)中id相同的事件连成一条流
+                // id超过2^53, 写成十六进制字符串, 避免JSON数值在查看器中丢失精度
+                fprintf(fp, ",\n{\"name\":\"frame\",\"cat\":\"%s\",\"ph\":\"%c\",\"bp\":\"e\",\"id\":\"0x%llx\",\"pid\":1,\"tid\":%d,\"ts\":%lld}",
+                    e.name, e.phase, (unsigned long long)e.arg, buf->tid, (long long)e.ts);
+                break;
+            }
+        }
+        total += n;
+        dropped += buf->dropped.load();
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    av_log(nullptr, AV_LOG_INFO, "trace: %d events written to %s, %lld dropped\n", total, path, (long long)dropped);
+    return total;
+}
+
+#endif
@@ -0,0 +1,48 @@
+/* 流水线trace: 编译时定义AV_TRACE(cmake -DAV_TRACE=ON)后记录各线程的耗时片段、瞬时事件和以帧为id的流事件,
+   退出时写出Chrome trace-event JSON(chrome://tracing或ui.perfetto.dev打开), 一帧可以从读包一直跟踪到显示.
+   每个线程写自己的缓冲区(按块分配, 记录时才分配), 记录时不加锁; 未定义AV_TRACE时所有宏为空 */
+#pragma once
+#include <cstdint>
+
+#ifdef AV_TRACE
+
+extern "C"
+{
+#include <libavutil/time.h>
+}
+
+void av_trace_set_limit(int events);       // 每个线程最多记录的事件数(默认262144), 需在开始记录前调用
+void av_trace_thread(const char* name);     // 设置当前线程名称(只在第一次调用时生效)
+void av_trace_complete(const char* name, int64_t start, int64_t dur);   // 耗时片段, us
+void av_trace_instant(const char* name);    // 瞬时事件
+void av_trace_flow(char phase, const char* cat, int64_t id);    // 流事件: 's'开始, 't'经过, 'f'结束, 需在片段内调用, id为AV_NOPTS_VALUE时不记录
+int av_trace_write(const char* path);       // 写出所有线程记录的事件, 返回事件数, <0为出错
+
+// 作用域内的耗时片段
+class AvTraceScope{
+private:
+    const char* name;
+    int64_t start;
+public:
+    AvTraceScope(const char* name): name(name), start(av_gettime_relative()){}
+    ~AvTraceScope(){ av_trace_complete(this->name, this->start, av_gettime_relative() - this->start); }
+};
+
+#define AV_TRACE_CONCAT2(a, b) a##b
+#define AV_TRACE_CONCAT(a, b) AV_TRACE_CONCAT2(a, b)
+#define AV_TRACE_SCOPE(name) AvTraceScope AV_TRACE_CONCAT(av_trace_scope_, __LINE__)(name)
+#define AV_TRACE_INSTANT(name) av_trace_instant(name)
+#define AV_TRACE_FLOW(phase, cat, id) av_trace_flow(phase, cat, id)
+#define AV_TRACE_THREAD(name) av_trace_thread(name)
+
+#else
+
+inline void av_trace_set_limit(int){}
+inline int av_trace_write(const char*){ return 0; }
+
+#define AV_TRACE_SCOPE(name) ((void)0)
+#define AV_TRACE_INSTANT(name) ((void)0)
+#define AV_TRACE_FLOW(phase, cat, id) ((void)0)
+#define AV_TRACE_THREAD(name) ((void)0)
+
+#endif
@@ -0,0 +1,164 @@
+#include "av_wall.h"
+
+extern "C"
+{
+#include <libavutil/time.h>
+}
+
+AvWall::AvWall(const std::vector<const char*>& inputs, int threads, int priority): pool(threads){
+    // 1. 初始化SDL事件(接收Ctrl+C产生的SDL_QUIT)和定时器
+    if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_EVENTS) < 0){
+        av_log(NULL, AV_LOG_ERROR, "SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
+        this->invalid = 1;
+        return;
+    }
+    this->sdl_inited = 1;
+    // 2. 打开所有流, 解码器单线程, 并行度由线程池提供
+    for (size_t i = 0; i < inputs.size(); i++){
+        Stream* s = new Stream();
+        s->src = inputs[i];
+        s->processor = new AvProcessor(inputs[i], 1);
+        s->video_sink = new NullVideoSink();
+        s->priority = ((int)i == priority) ? 1 : 0;
+        this->streams.push_back(s);
+        if (s->processor->invalid){
+            av_log(NULL, AV_LOG_ERROR, "open %s failed\n", inputs[i]);
+            this->invalid = 1;
+            continue;
+        }
+        // 3. 每路流的解复用、视频解码、音频解码、输出任务
+        AvProcessor* p = s->processor;
+        this->tasks.push_back(new StageTask(p, &AvProcessor::demux_step, s->priority));
+        if (p->has_video())
+            this->tasks.push_back(new StageTask(p, &AvProcessor::decode_video_step, s->priority));
+        if (p->has_audio())
+            this->tasks.push_back(new StageTask(p, &AvProcessor::decode_audio_step, s->priority));
+    }
+}
+
+AvWall::~AvWall(){
+    this->pool.stop();  // 先停止线程池, 之后没有线程再访问任务和流
+    for (AvPoolTask* t: this->tasks){
+        delete t;
+    }
+    for (Stream* s: this->streams){
+        av_frame_free(&s->frame);
+        delete s->video_sink;
+        if (s->processor)
+            s->processor->stop();
+        delete s->processor;
+        delete s;
+    }
+    if (this->sdl_inited)
+        SDL_Quit();
+}
+
+// 输出一步: 消耗到当前时间为止的音频数据, 显示到时间的视频帧
+int AvWall::Stream::run_step(){
+    AvProcessor* p = this->processor;
+    int progress = 0;
+    int64_t now = av_gettime_relative();
+    // 1. 音频: 没有声卡, 按采样率消耗数据, 使音频解码保持实时速度
+    if (p->has_audio()){
+        int frame_bytes = p->get_channels() * 2;    // S16
+        int64_t bytes_per_sec = (int64_t)p->get_sample_rate() * frame_bytes;
+        if (!this->audio_time)
+            this->audio_time = now;
+        int64_t bytes = (now - this->audio_time) * bytes_per_sec / 1000000 / frame_bytes * frame_bytes;
+        if (bytes > 0){
+            p->audio_chunk_discard(bytes);
+            this->audio_time += bytes * 1000000 / bytes_per_sec;
+            progress = 1;
+        }
+    }
+    // 2. 视频: 同步到外部时钟, 第一帧时把外部时钟对齐到该帧
+    if (p->has_video()){
+        if (!this->frame)
+            p->video_frame_try_pop(this->frame);
+        if (this->frame){
+            double video_clock = p->get_video_clock(this->frame);
+            if (!this->started){
+                p->set_ext_clock(video_clock);
+                this->started = 1;
+            }
+            double delay = video_clock - p->get_ext_clock();
+            if (delay <= 0){    // 到时间了
+                if (delay < -1){    // 落后太多, 丢弃
+                    p->stats.v_frames_dropped++;
+                }else{
+                    this->video_sink->display(this->frame);
+                    p->stats.v_frames_displayed++;
+                    p->stats.add_sync_error(delay);         // 显示时落后外部时钟的时间
+                    p->add_display_latency(this->frame);    // 解码完成到显示的时间, 即这路流的延迟
+                }
+                av_frame_free(&this->frame);
+                progress = 1;
+            }
+        }
+    }
+    // 3. 输入结束且数据都已输出, 或出错(解复用/解码任务已结束, 不会再有数据)
+    if (p->invalid || (!this->frame && p->finished())){
+        this->done = 1;
+        return -1;
+    }
+    return progress;
+}
+
+int AvWall::play(){
+    if (this->invalid){
+        return 1;
+    }
+    // 1. 所有流从0开始走外部时钟, 把任务交给线程池
+    this->start_time = av_gettime_relative();
+    for (Stream* s: this->streams){
+        s->processor->set_ext_clock(0);
+        this->pool.add(s);
+    }
+    for (AvPoolTask* t: this->tasks){
+        this->pool.add(t);
+    }
+    // 2. 等待所有流结束或退出信号, 定期打印统计
+    SDL_Event event;
+    int64_t last_report = this->start_time;
+    while (1){
+        if (SDL_WaitEventTimeout(&event, 100) && event.type == SDL_QUIT){
+            break;
+        }
+        int done = 1;
+        for (Stream* s: this->streams){
+            done &= s->done.load();
+        }
+        if (done){
+            break;
+        }
+        if (av_gettime_relative() - last_report >= 5000000){
+            this->report();
+            last_report = av_gettime_relative();
+        }
+    }
+    // 3. 停止
+    this->pool.stop();
+    for (Stream* s: this->streams){
+        s->processor->stop();
+    }
+    this->report();
+    return 0;
+}
+
+void AvWall::report(){
+    double elapsed = (av_gettime_relative() - this->start_time) / 1000000.0;
+    int64_t total = 0;
+    for (size_t i = 0; i < this->streams.size(); i++){
+        AvStats& st = this->streams[i]->processor->stats;
+        int64_t decoded = st.v_frames_decoded.load();
+        total += decoded;
+        av_log(nullptr, AV_LOG_INFO, "[stats] stream %zu%s: %s, decoded %lld (%.1f fps), displayed %lld, dropped %lld, "
+            "decode->display avg %.2f ms max %.2f ms\n", i, this->streams[i]->priority > 0 ? " (priority)" : "",
+            this->streams[i]->src, (long long)decoded, elapsed > 0 ? decoded / elapsed : 0.,
+            (long long)st.v_frames_displayed.load(), (long long)st.v_frames_dropped.load(),
+            st.v_display_latency.avg() / 1000.0, st.v_display_latency_max.load() / 1000.0);
+    }
+    av_log(nullptr, AV_LOG_INFO, "[stats] total: %zu streams, %.1f s, decoded %lld frames (%.1f fps)\n",
+        this->streams.size(), elapsed, (long long)total, elapsed > 0 ? total / elapsed : 0.);
+    this->pool.report();
+}
@@ -0,0 +1,44 @@
+/* 多路流模式(无窗口, 模拟监控墙的解码负载): 所有流的解复用、解码、输出都由一个固定大小的线程池调度, 不再每路流各开3个线程 */
+#pragma once
+#include "av_processor.h"
+#include "av_pool.h"
+#include "av_sink.h"
+#include <vector>
+
+class AvWall{
+private:
+    // 一路流的输出任务: 视频帧按外部时钟送到视频后端, 音频数据按实时速度消耗
+    struct Stream: public AvPoolTask{
+        const char* src;
+        AvProcessor* processor = nullptr;
+        VideoSink* video_sink = nullptr;
+        AVFrame* frame = nullptr;       // 等待显示的帧
+        int started = 0;                // 外部时钟是否已对齐到第一帧
+        int64_t audio_time = 0;         // 音频数据已消耗到的系统时间, us
+        std::atomic<int> done{0};       // 输入结束且数据都已输出
+        int run_step() override;
+    };
+    // 解复用/解码任务, 调用AvProcessor的对应step函数
+    struct StageTask: public AvPoolTask{
+        AvProcessor* processor;
+        int (AvProcessor::*step)();
+        StageTask(AvProcessor* processor, int (AvProcessor::*step)(), int priority): processor(processor), step(step){
+            this->priority = priority;
+        }
+        int run_step() override { return (this->processor->*step)(); }
+    };
+    std::vector<Stream*> streams;
+    std::vector<AvPoolTask*> tasks;
+    AvTaskPool pool;
+    int64_t start_time = 0;
+    int sdl_inited = 0;
+    int invalid = 0;
+public:
+    // threads为线程池大小(0为CPU核数), priority为优先调度的流序号(<0表示没有)
+    AvWall(const std::vector<const char*>& inputs, int threads, int priority);
+    ~AvWall();
+    AvWall(const AvWall&) = delete;
+    AvWall& operator=(const AvWall&) = delete;
+    int play();     // 播放直到所有流结束或收到退出信号
+    void report();  // 打印总吞吐和每路流的统计
+};
@@ -6,32 +6,125 @@
 /*
  * [ ] TODO: 
  * - [ ] 视频pts无效时没有处理, 而且继续用来计算
- * - [ ] 多次快进快退会segmentation fault, 可能还有些小bug
  */
 
 #include "av_SDL.h"
+#include "av_wall.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+
+static void usage(const char* prog){
+    av_log(NULL, AV_LOG_ERROR, "usage: %s [options] <input>\n"
+        "  -vo sdl|null|yuv:<file>   video output (default sdl, - for stdout)\n"
+        "  -ao sdl|null|pcm:<file>   audio output (default sdl, - for stdout)\n"
+        "  -autoexit                 exit at end of input (default for non-sdl outputs)\n"
+        "  -fast                     no A/V sync, output as fast as possible\n"
+        "  -generic                  always convert with sws_scale/swr_convert (compare convert cost with i)\n"
+        "  -trace <file>             trace output of an AV_TRACE build (default av_trace.json)\n"
+        "  -trace-events <n>         max trace events per thread, allocated as recorded (default 262144)\n"
+        "  -abuf <samples>           audio device buffer size (default 2048, 512 with -lowlatency)\n"
+        "  -lowlatency               keep only two device buffers of decoded audio queued\n"
+        "  -live                     follow a growing file or live stream, keep latency bounded\n"
+        "  -latency <ms>             live latency target (default 500)\n"
+        "  -cache <MB>|auto          memory budget of the displayed frame cache (default 0, off; auto fits a 3 s back seek)\n"
+        "  -loop                     restart from the beginning at end of input\n"
+        "  -soak <s>                 loop and sample resources for s seconds (0 until quit), fail on regression\n"
+        "  -soak-report <file>       soak time series CSV (default soak.csv)\n"
+        "  -soak-interval <s>        soak sample interval (default 10)\n"
+        "  -soak-rss <MB>            max resident memory growth over the baseline (default 32)\n"
+        "  -soak-rss-pct <n>         max resident memory growth in percent of the baseline (default 25, larger limit wins)\n"
+        "  -soak-drift <ms>          max increase of the average A/V drift per interval over the baseline (default 40)\n"
+        "  -soak-frametime <ms>      max increase of the p99 frame interval over the baseline (default 100)\n"
+        "multiple inputs are decoded headless in one process (load generation for e.g. a monitoring wall, no tiles are drawn):\n"
+        "  -threads <n>              size of the shared decode pool (default: CPU count)\n"
+        "  -priority <i>             index of the input scheduled first (default 0)\n", prog);
+}
 
 int main(int argc, char *argv[]){
     av_log_set_level(AV_LOG_INFO);  // 设置日志级别
     // 0. 命令行参数解析
-    if (argc < 2) {  // 错误处理
-        av_log(NULL, AV_LOG_ERROR, "usage: %s <input>\n", argv[0]);
-        return 1;
+    PlayerConfig config;
+    std::vector<const char*> inputs;
+    int threads = 0, priority = 0, fast_convert = 1;
+    const char* trace_path = "av_trace.json";
+    int live = 0, latency_ms = 500;
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "-vo") == 0 && i + 1 < argc){
+            config.video_out = argv[++i];
+        }else if (strcmp(argv[i], "-ao") == 0 && i + 1 < argc){
+            config.audio_out = argv[++i];
+        }else if (strcmp(argv[i], "-autoexit") == 0){
+            config.autoexit = 1;
+        }else if (strcmp(argv[i], "-fast") == 0){
+            config.free_run = 1;
+        }else if (strcmp(argv[i], "-generic") == 0){
+            fast_convert = 0;
+        }else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc){
+            trace_path = argv[++i];
+        }else if (strcmp(argv[i], "-trace-events") == 0 && i + 1 < argc){
+            av_trace_set_limit(atoi(argv[++i]));
+        }else if (strcmp(argv[i], "-abuf") == 0 && i + 1 < argc){
+            config.audio_samples = atoi(argv[++i]);
+        }else if (strcmp(argv[i], "-lowlatency") == 0){
+            config.low_latency = 1;
+        }else if (strcmp(argv[i], "-live") == 0){
+            live = 1;
+        }else if (strcmp(argv[i], "-latency") == 0 && i + 1 < argc){
+            latency_ms = atoi(argv[++i]);
+        }else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc){
+            i++;
+            config.cache_mb = strcmp(argv[i], "auto") == 0 ? -1 : atoi(argv[i]);
+        }else if (strcmp(argv[i], "-loop") == 0){
+            config.loop = 1;
+        }else if (strcmp(argv[i], "-soak") == 0 && i + 1 < argc){
+            config.soak = 1;
+            config.soak_config.duration = atoi(argv[++i]);
+        }else if (strcmp(argv[i], "-soak-report") == 0 && i + 1 < argc){
+            config.soak_config.report = argv[++i];
+        }else if (strcmp(argv[i], "-soak-interval") == 0 && i + 1 < argc){
+            config.soak_config.interval = std::max(1, atoi(argv[++i]));
+        }else if (strcmp(argv[i], "-soak-rss") == 0 && i + 1 < argc){
+            config.soak_config.max_rss_growth_mb = atoi(argv[++i]);
+        }else if (strcmp(argv[i], "-soak-rss-pct") == 0 && i + 1 < argc){
+            config.soak_config.max_rss_growth_pct = atoi(argv[++i]);
+        }else if (strcmp(argv[i], "-soak-drift") == 0 && i + 1 < argc){
+            config.soak_config.max_drift_ms = atoi(argv[++i]);
+        }else if (strcmp(argv[i], "-soak-frametime") == 0 && i + 1 < argc){
+            config.soak_config.max_frame_ms = atoi(argv[++i]);
+        }else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc){
+            threads = atoi(argv[++i]);
+        }else if (strcmp(argv[i], "-priority") == 0 && i + 1 < argc){
+            priority = atoi(argv[++i]);
+        }else if (argv[i][0] == '-' && argv[i][1]){
+            usage(argv[0]);
+            return 1;
+        }else{
+            inputs.push_back(argv[i]);
+        }
     }
-    char *src = argv[1];
-    if (!src) {
-        av_log(NULL, AV_LOG_ERROR, "input is NULL\n");
+    if (inputs.empty()) {  // 错误处理
+        usage(argv[0]);
         return 1;
     }
+    // 多路输入: 共享线程池的多路流模式
+    if (inputs.size() > 1){
+        AvWall wall(inputs, threads, priority);
+        int ret = wall.play();
+        av_trace_write(trace_path);
+        return ret;
+    }
+    const char *src = inputs[0];
 
     // 1. 创建AvProcessor对象
-    AvProcessor processor(src);
-
-    // 2. 初始化SDL播放器
-    Player player(&processor);
+    AvProcessor processor(src, 0, fast_convert, live ? latency_ms / 1000.0 : 0);
 
-    // 3. 播放
-    player.play();
+    // 2. 初始化播放器
+    Player player(&processor, config);
 
-    return 0;
-}
\ No newline at end of file
+    // 3. 播放, 结束后写出trace(编译时开启AV_TRACE才有)
+    int ret = player.play();
+    av_trace_write(trace_path);
+    return ret;
+}
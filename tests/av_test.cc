@@ -0,0 +1,701 @@
+/* 播放器测试: 用FFmpeg编码器在进程内生成合成音视频文件, 用空输出后端驱动AvProcessor和Player,
+   检查同步误差、丢帧、seek落点和随机seek压力下的稳定性; 编译选项带ASan, 泄漏由LeakSanitizer在退出时报告
+   用法: av_test <用例名>, 每个用例单独一个进程(ctest中由SDL_VIDEODRIVER/SDL_AUDIODRIVER=dummy运行) */
+
+#include "../av_SDL.h"
+#include "../av_wall.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <random>
+#include <string>
+#include <thread>
+#include <functional>
+#include <vector>
+#include <unistd.h>
+
+extern "C"
+{
+#include <libavutil/channel_layout.h>
+}
+
+// 合成媒体参数
+static const int W = 320, H = 240;
+static const int FPS = 25;
+static const int GOP = 5;               // 关键帧间隔(帧), 对齐到关键帧的seek应准确落点
+static const int SAMPLE_RATE = 44100;
+static const int CHANNELS = 2;
+
+static std::atomic<int> failures{0};   // 驱动线程和主线程都会记录失败
+
+#define CHECK(cond, ...) do{ \
+    if (!(cond)){ \
+        av_log(nullptr, AV_LOG_ERROR, "%s:%d: CHECK(%s) failed: ", __FILE__, __LINE__, #cond); \
+        av_log(nullptr, AV_LOG_ERROR, __VA_ARGS__); \
+        av_log(nullptr, AV_LOG_ERROR, "\n"); \
+        failures++; \
+    } \
+}while(0)
+
+// 临时文件路径, 进程号区分并发运行的用例
+static std::string temp_path(const char* name){
+    const char* dir = std::getenv("TMPDIR");
+    return std::string(dir ? dir : "/tmp") + "/av_test_" + std::to_string(getpid()) + "_" + name;
+}
+
+static std::vector<uint8_t> read_file(const char* path){
+    std::vector<uint8_t> data;
+    std::FILE* fp = std::fopen(path, "rb");
+    if (!fp)
+        return data;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    std::fclose(fp);
+    return data;
+}
+
+static long file_size(const char* path){
+    std::FILE* fp = std::fopen(path, "rb");
+    if (!fp)
+        return -1;
+    std::fseek(fp, 0, SEEK_END);
+    long size = std::ftell(fp);
+    std::fclose(fp);
+    return size;
+}
+
+// 轮询等待条件成立, 超时返回false
+static bool wait_for(const std::function<bool()>& cond, int timeout_ms){
+    int64_t deadline = av_gettime_relative() + (int64_t)timeout_ms * 1000;
+    while (!cond()){
+        if (av_gettime_relative() > deadline)
+            return false;
+        SDL_Delay(5);
+    }
+    return true;
+}
+
+static void push_quit(){
+    SDL_Event quit;
+    quit.type = SDL_QUIT;
+    SDL_PushEvent(&quit);
+}
+
+// 模拟按键(事件循环只看keysym.sym)
+static void push_key(SDL_Keycode key){
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = SDL_KEYDOWN;
+    event.key.keysym.sym = key;
+    SDL_PushEvent(&event);
+}
+
+/* 合成媒体: MPEG-4视频(移动的渐变, 固定GOP, 无B帧) + PCM S16立体声正弦波, 封装为Matroska */
+class SyntheticMedia{
+private:
+    AVFormatContext* oc = nullptr;
+    AVCodecContext* venc = nullptr;
+    AVCodecContext* aenc = nullptr;
+    AVStream* vs = nullptr;
+    AVStream* as = nullptr;
+    AVPacket* pkt = nullptr;
+    AVPixelFormat pix_fmt = AV_PIX_FMT_YUV420P;
+    AVCodecContext* open_encoder(AVCodecID id, AVStream** st);
+    int encode(AVCodecContext* ctx, AVStream* st, AVFrame* frame);
+    int write_video(int i);
+    int write_audio(int64_t pts, int samples);
+public:
+    ~SyntheticMedia();
+    // 0为成功, vcodec为MJPEG时视频是全范围的YUVJ420P
+    int write(const char* path, double seconds, int video, int audio, AVCodecID vcodec = AV_CODEC_ID_MPEG4);
+};
+
+SyntheticMedia::~SyntheticMedia(){
+    avcodec_free_context(&this->venc);
+    avcodec_free_context(&this->aenc);
+    av_packet_free(&this->pkt);
+    if (this->oc){
+        avio_closep(&this->oc->pb);
+        avformat_free_context(this->oc);
+    }
+}
+
+AVCodecContext* SyntheticMedia::open_encoder(AVCodecID id, AVStream** st){
+    const AVCodec* codec = avcodec_find_encoder(id);
+    if (!codec){
+        av_log(nullptr, AV_LOG_ERROR, "encoder %s not found\n", avcodec_get_name(id));
+        return nullptr;
+    }
+    AVCodecContext* ctx = avcodec_alloc_context3(codec);
+    if (!ctx)
+        return nullptr;
+    if (codec->type == AVMEDIA_TYPE_VIDEO){
+        ctx->width = W;
+        ctx->height = H;
+        ctx->time_base = AVRational{1, FPS};
+        ctx->framerate = AVRational{FPS, 1};
+        ctx->pix_fmt = this->pix_fmt;
+        ctx->gop_size = GOP;
+        ctx->max_b_frames = 0;
+        ctx->bit_rate = 400000;
+    }else{
+        ctx->sample_fmt = AV_SAMPLE_FMT_S16;
+        ctx->sample_rate = SAMPLE_RATE;
+        av_channel_layout_default(&ctx->ch_layout, CHANNELS);
+        ctx->time_base = AVRational{1, SAMPLE_RATE};
+    }
+    if (this->oc->oformat->flags & AVFMT_GLOBALHEADER)
+        ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    *st = avformat_new_stream(this->oc, nullptr);
+    if (!*st || avcodec_open2(ctx, codec, nullptr) < 0 || avcodec_parameters_from_context((*st)->codecpar, ctx) < 0){
+        av_log(nullptr, AV_LOG_ERROR, "open encoder %s failed\n", codec->name);
+        avcodec_free_context(&ctx);
+        return nullptr;
+    }
+    (*st)->time_base = ctx->time_base;
+    return ctx;
+}
+
+// 送入一帧(frame为空时取出剩余packet)并写出得到的packet
+int SyntheticMedia::encode(AVCodecContext* ctx, AVStream* st, AVFrame* frame){
+    if (avcodec_send_frame(ctx, frame) < 0)
+        return -1;
+    int ret;
+    while ((ret = avcodec_receive_packet(ctx, this->pkt)) >= 0){
+        av_packet_rescale_ts(this->pkt, ctx->time_base, st->time_base);
+        this->pkt->stream_index = st->index;
+        if (av_interleaved_write_frame(this->oc, this->pkt) < 0)
+            return -1;
+    }
+    return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : -1;
+}
+
+int SyntheticMedia::write_video(int i){
+    AVFrame* frame = av_frame_alloc();
+    frame->format = this->pix_fmt;
+    frame->width = W;
+    frame->height = H;
+    if (av_frame_get_buffer(frame, 0) < 0){
+        av_frame_free(&frame);
+        return -1;
+    }
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            frame->data[0][y * frame->linesize[0] + x] = (uint8_t)(x + y + i * 3);
+    for (int y = 0; y < H / 2; y++){
+        memset(frame->data[1] + y * frame->linesize[1], 128, W / 2);
+        memset(frame->data[2] + y * frame->linesize[2], 128, W / 2);
+    }
+    frame->pts = i;
+    int ret = this->encode(this->venc, this->vs, frame);
+    av_frame_free(&frame);
+    return ret;
+}
+
+int SyntheticMedia::write_audio(int64_t pts, int samples){
+    AVFrame* frame = av_frame_alloc();
+    frame->format = AV_SAMPLE_FMT_S16;
+    frame->nb_samples = samples;
+    frame->sample_rate = SAMPLE_RATE;
+    av_channel_layout_copy(&frame->ch_layout, &this->aenc->ch_layout);
+    if (av_frame_get_buffer(frame, 0) < 0){
+        av_frame_free(&frame);
+        return -1;
+    }
+    int16_t* data = (int16_t*)frame->data[0];
+    for (int i = 0; i < samples; i++){
+        int16_t v = (int16_t)(8000 * std::sin(2 * M_PI * 440 * (pts + i) / SAMPLE_RATE));
+        for (int c = 0; c < CHANNELS; c++)
+            data[i * CHANNELS + c] = v;
+    }
+    frame->pts = pts;
+    int ret = this->encode(this->aenc, this->as, frame);
+    av_frame_free(&frame);
+    return ret;
+}
+
+int SyntheticMedia::write(const char* path, double seconds, int video, int audio, AVCodecID vcodec){
+    // 1. 创建输出和编码器
+    if (avformat_alloc_output_context2(&this->oc, nullptr, "matroska", path) < 0)
+        return -1;
+    this->pkt = av_packet_alloc();
+    if (vcodec == AV_CODEC_ID_MJPEG)
+        this->pix_fmt = AV_PIX_FMT_YUVJ420P;
+    if (video && !(this->venc = this->open_encoder(vcodec, &this->vs)))
+        return -1;
+    if (audio && !(this->aenc = this->open_encoder(AV_CODEC_ID_PCM_S16LE, &this->as)))
+        return -1;
+    if (avio_open(&this->oc->pb, path, AVIO_FLAG_WRITE) < 0 || avformat_write_header(this->oc, nullptr) < 0)
+        return -1;
+    // 2. 按时间顺序交替编码视频帧和音频帧
+    int frames = video ? (int)(seconds * FPS) : 0;
+    int64_t samples = audio ? (int64_t)(seconds * SAMPLE_RATE) : 0;
+    int i = 0;
+    int64_t a_pts = 0;
+    while (i < frames || a_pts < samples){
+        if (a_pts >= samples || (i < frames && (double)i / FPS <= (double)a_pts / SAMPLE_RATE)){
+            if (this->write_video(i++) < 0)
+                return -1;
+        }else{
+            int n = (int)std::min<int64_t>(1024, samples - a_pts);
+            if (this->write_audio(a_pts, n) < 0)
+                return -1;
+            a_pts += n;
+        }
+    }
+    // 3. 取出编码器剩余数据, 写文件尾
+    if ((this->venc && this->encode(this->venc, this->vs, nullptr) < 0)
+        || (this->aenc && this->encode(this->aenc, this->as, nullptr) < 0))
+        return -1;
+    return av_write_trailer(this->oc);
+}
+
+// 生成合成媒体文件, 失败时记为测试失败
+static bool make_media(const std::string& path, double seconds, int video, int audio, AVCodecID vcodec = AV_CODEC_ID_MPEG4){
+    SyntheticMedia media;
+    int ret = media.write(path.c_str(), seconds, video, audio, vcodec);
+    CHECK(ret == 0, "writing synthetic media %s failed", path.c_str());
+    return ret == 0;
+}
+
+// 空输出后端的播放器配置
+static PlayerConfig null_config(){
+    PlayerConfig config;
+    config.video_out = "null";
+    config.audio_out = "null";
+    return config;
+}
+
+/* 同步: 实时播放到结束, 所有帧都显示或丢弃, 同步误差和丢帧在阈值内 */
+static void check_sync(int audio){
+    const double seconds = 4;
+    std::string path = temp_path("sync.mkv");
+    if (!make_media(path, seconds, 1, audio))
+        return;
+    {
+        AvProcessor processor(path.c_str());
+        CHECK(processor.invalid == 0, "AvProcessor invalid %d", processor.invalid);
+        CHECK(processor.has_audio() == (bool)audio, "has_audio %d", processor.has_audio());
+        PlayerConfig config = null_config();
+        config.autoexit = 1;
+        Player player(&processor, config);
+        CHECK(player.play() == 0, "play failed");
+        AvStats& stats = processor.stats;
+        int64_t frames = (int64_t)(seconds * FPS);
+        int64_t displayed = stats.v_frames_displayed, dropped = stats.v_frames_dropped;
+        int64_t samples = stats.sync_samples;
+        double avg_ms = samples ? stats.sync_err_sum / 1000.0 / samples : 0;
+        CHECK(stats.v_frames_decoded == frames, "decoded %lld of %lld frames", (long long)stats.v_frames_decoded.load(), (long long)frames);
+        CHECK(displayed + dropped == frames, "displayed %lld + dropped %lld != %lld", (long long)displayed, (long long)dropped, (long long)frames);
+        CHECK(dropped <= 2, "dropped %lld frames", (long long)dropped);
+        CHECK(samples > 0 && avg_ms < 30, "avg sync error %.2f ms over %lld frames", avg_ms, (long long)samples);
+        CHECK(stats.sync_err_max < 250000, "max sync error %.2f ms", stats.sync_err_max / 1000.0);
+    }
+    std::remove(path.c_str());
+}
+
+static void test_sync(){ check_sync(1); }
+static void test_sync_video_only(){ check_sync(0); }
+
+/* 纯音频: 不创建窗口和视频线程, 空输出按采样率拉取数据, 全部PCM输出后自动退出(没有窗口/声卡时默认自动退出), 播放用时接近片长 */
+static void test_sync_audio_only(){
+    const double seconds = 3;
+    std::string path = temp_path("audio.mkv");
+    if (!make_media(path, seconds, 0, 1))
+        return;
+    {
+        AvProcessor processor(path.c_str());
+        CHECK(processor.invalid == 0, "AvProcessor invalid %d", processor.invalid);
+        CHECK(!processor.has_video() && processor.has_audio(), "has_video %d, has_audio %d", processor.has_video(), processor.has_audio());
+        Player player(&processor, null_config());
+        AvStats& stats = processor.stats;
+        int64_t expected = (int64_t)(seconds * SAMPLE_RATE) * CHANNELS * 2;
+        int64_t start = av_gettime_relative();
+        CHECK(player.play() == 0, "play failed");
+        double elapsed = (av_gettime_relative() - start) / 1000000.0;
+        CHECK(stats.a_bytes_decoded == expected, "decoded %lld bytes, expected %lld", (long long)stats.a_bytes_decoded.load(), (long long)expected);
+        CHECK(elapsed >= seconds * 0.9, "audio output in %.2f s, not paced at the sample rate", elapsed);
+        CHECK(stats.v_frames_displayed == 0 && stats.v_frames_decoded == 0, "video frames in an audio-only input");
+    }
+    std::remove(path.c_str());
+}
+
+/* seek落点: 在播放中seek到关键帧对齐的位置, seek后显示的第一帧应落在目标附近(不能是seek前留在队列中的帧) */
+static void test_seek_landing(){
+    std::string path = temp_path("seek.mkv");
+    if (!make_media(path, 6, 1, 1))
+        return;
+    {
+        AvProcessor processor(path.c_str());
+        CHECK(processor.invalid == 0, "AvProcessor invalid %d", processor.invalid);
+        Player player(&processor, null_config());
+        AvStats& stats = processor.stats;
+        // 目标都对齐到关键帧(GOP为0.2s), 且与当前位置相距1s以上
+        const double targets[] = {4.0, 1.0, 3.4, 0.2, 2.6};
+        std::thread driver([&](){
+            wait_for([&](){ return stats.v_frames_displayed >= 10; }, 10000);
+            for (double target: targets){
+                int64_t landings = stats.seek_landings;
+                processor.set_seek_flag(-1, target);
+                bool landed = wait_for([&](){ return stats.seek_landings > landings; }, 5000);
+                CHECK(landed, "seek to %.1f s never landed", target);
+                if (landed){
+                    double err = stats.seek_err_last / 1000000.0;
+                    CHECK(std::fabs(err) <= 0.1, "seek to %.1f s landed %.3f s away", target, err);
+                }
+                int64_t shown = stats.v_frames_displayed;   // 播放一会再seek下一次
+                wait_for([&](){ return stats.v_frames_displayed >= shown + 10; }, 5000);
+            }
+            push_quit();
+        });
+        CHECK(player.play() == 0, "play failed");
+        driver.join();
+        int n = sizeof(targets) / sizeof(targets[0]);
+        CHECK(stats.seeks == n, "%lld seeks executed, %d requested", (long long)stats.seeks.load(), n);
+    }
+    std::remove(path.c_str());
+}
+
+/* 随机seek压力: 几千次随机位置、随机方向的seek(间隔0-2ms, 部分会合并), 之后播放仍然正常, 落点仍然准确 */
+static void test_seek_stress(){
+    std::string path = temp_path("stress.mkv");
+    const double seconds = 6;
+    if (!make_media(path, seconds, 1, 1))
+        return;
+    {
+        AvProcessor processor(path.c_str());
+        CHECK(processor.invalid == 0, "AvProcessor invalid %d", processor.invalid);
+        Player player(&processor, null_config());
+        AvStats& stats = processor.stats;
+        std::thread driver([&](){
+            std::mt19937 rng(20240601);
+            std::uniform_real_distribution<double> pos(0, seconds);
+            wait_for([&](){ return stats.v_frames_displayed >= 5; }, 10000);
+            for (int i = 1; i <= 3000; i++){
+                processor.set_seek_flag((rng() & 1) ? 1 : -1, pos(rng));
+                SDL_Delay(rng() % 3);
+                if (i % 100 == 0){  // 定期等一次显示, 让seek后的解码和显示也参与进来
+                    int64_t shown = stats.v_frames_displayed;
+                    wait_for([&](){ return stats.v_frames_displayed > shown; }, 2000);
+                }
+            }
+            // 先播放几帧, 让最后一次随机seek的落点统计完成, 避免算到下面的seek上
+            int64_t played = stats.v_frames_displayed;
+            wait_for([&](){ return stats.v_frames_displayed >= played + 5; }, 2000);
+            // 最后一次seek: 落点准确, 之后继续播放
+            int64_t landings = stats.seek_landings;
+            processor.set_seek_flag(-1, 1.0);
+            bool landed = wait_for([&](){ return stats.seek_landings > landings; }, 5000);
+            CHECK(landed, "final seek never landed");
+            if (landed)
+                CHECK(std::fabs(stats.seek_err_last / 1000000.0) <= 0.1, "final seek landed %.3f s away", stats.seek_err_last / 1000000.0);
+            int64_t shown = stats.v_frames_displayed;
+            CHECK(wait_for([&](){ return stats.v_frames_displayed >= shown + 10; }, 5000), "playback stalled after seeks");
+            push_quit();
+        });
+        CHECK(player.play() == 0, "play failed");
+        driver.join();
+        CHECK(stats.seeks >= 100, "only %lld seeks executed", (long long)stats.seeks.load());
+    }
+    std::remove(path.c_str());
+}
+
+/* 缓冲满时退出: 解码线程阻塞在满的帧队列上时退出, 没有放入队列的帧和帧池都要释放(由LeakSanitizer检查)
+   用纯视频文件, 有音频时解码领先播放的时间受音频缓冲限制, 帧队列不一定能填满 */
+static void test_quit_buffered(){
+    std::string path = temp_path("quit.mkv");
+    if (!make_media(path, 10, 1, 0))
+        return;
+    {
+        AvProcessor processor(path.c_str());
+        CHECK(processor.invalid == 0, "AvProcessor invalid %d", processor.invalid);
+        Player player(&processor, null_config());
+        std::thread driver([&](){
+            AvStats& stats = processor.stats;
+            bool full = wait_for([&](){     // 解码了但还没显示或丢弃的帧占满帧队列(100帧)
+                return stats.v_frames_decoded - stats.v_frames_displayed - stats.v_frames_dropped >= 100;
+            }, 10000);
+            CHECK(full, "frame queue never filled");
+            push_quit();
+        });
+        CHECK(player.play() == 0, "play failed");
+        driver.join();
+    }
+    std::remove(path.c_str());
+}
+
+/* PCM文件输出: 不同步尽快输出时, 文件中只有解码得到的数据(结尾不追加静音) */
+static void test_pcm_output(){
+    const double seconds = 3;
+    std::string path = temp_path("pcm.mkv");
+    std::string pcm = temp_path("out.pcm");
+    std::string spec = "pcm:" + pcm;
+    if (!make_media(path, seconds, 1, 1))
+        return;
+    int64_t decoded = 0;
+    {
+        AvProcessor processor(path.c_str());
+        CHECK(processor.invalid == 0, "AvProcessor invalid %d", processor.invalid);
+        PlayerConfig config = null_config();
+        config.audio_out = spec.c_str();
+        config.autoexit = 1;
+        config.free_run = 1;
+        Player player(&processor, config);
+        CHECK(player.play() == 0, "play failed");
+        decoded = processor.stats.a_bytes_decoded;
+    }   // 析构时关闭文件
+    long expected = (long)(seconds * SAMPLE_RATE) * CHANNELS * 2;
+    long size = file_size(pcm.c_str());
+    CHECK(decoded == expected, "decoded %lld bytes, expected %ld", (long long)decoded, expected);
+    CHECK(size == expected, "pcm file has %ld bytes, expected %ld", size, expected);
+    std::remove(path.c_str());
+    std::remove(pcm.c_str());
+}
+
+/* 多路流模式结束: 完整的流和截断的流(读到一半出错或提前结束)都要结束, play不能一直等待 */
+static void test_wall_finish(){
+    std::string path = temp_path("wall.mkv");
+    std::string cut = temp_path("wall_cut.mkv");
+    if (!make_media(path, 2, 1, 1))
+        return;
+    std::vector<uint8_t> data = read_file(path.c_str());
+    FILE* f = fopen(cut.c_str(), "wb");
+    CHECK(f && fwrite(data.data(), 1, data.size() / 2, f) == data.size() / 2, "write %s failed", cut.c_str());
+    if (f)
+        fclose(f);
+    {
+        std::vector<const char*> inputs = {path.c_str(), cut.c_str(), path.c_str()};
+        AvWall wall(inputs, 2, 0);
+        std::atomic<int> done{0};
+        std::thread driver([&](){
+            CHECK(wait_for([&](){ return done.load() != 0; }, 30000), "wall did not finish");
+            if (!done)
+                push_quit();
+        });
+        CHECK(wall.play() == 0, "wall play failed");
+        done = 1;
+        driver.join();
+    }
+    std::remove(path.c_str());
+    std::remove(cut.c_str());
+}
+
+/* 帧缓存: 播放中快退3s时目标帧在缓存中(auto预算能放下一次快退距离), 立即显示并从该帧位置seek;
+   之后暂停步进一帧, 下一帧经定时显示的同一路径输出 */
+static void test_cache_seek(){
+    std::string path = temp_path("cache.mkv");
+    if (!make_media(path, 8, 1, 1))
+        return;
+    {
+        AvProcessor processor(path.c_str());
+        CHECK(processor.invalid == 0, "AvProcessor invalid %d", processor.invalid);
+        PlayerConfig config = null_config();
+        config.cache_mb = -1;
+        Player player(&processor, config);
+        std::thread driver([&](){
+            AvStats& stats = processor.stats;
+            // 1. 播放4s后快退3s, 缓存命中
+            CHECK(wait_for([&](){ return stats.v_frames_displayed >= 4 * FPS; }, 10000), "playback did not reach 4 s");
+            push_key(SDLK_LEFT);
+            CHECK(wait_for([&](){ return stats.seek_landings >= 1; }, 10000), "no frame displayed after the back seek");
+            CHECK(stats.cache_hits == 1 && stats.cache_misses == 0, "cache hits %lld, misses %lld",
+                (long long)stats.cache_hits.load(), (long long)stats.cache_misses.load());
+            CHECK(stats.seeks == 1, "%lld seeks", (long long)stats.seeks.load());
+            // 2. 暂停并前进一帧, 等解码线程放入下一帧后只显示这一帧
+            SDL_Delay(200);
+            int64_t displayed = stats.v_frames_displayed;
+            push_key(SDLK_PERIOD);
+            CHECK(wait_for([&](){ return stats.v_frames_displayed == displayed + 1; }, 2000), "step did not display a frame");
+            SDL_Delay(200);
+            CHECK(stats.v_frames_displayed == displayed + 1, "displayed %lld frames while paused",
+                (long long)(stats.v_frames_displayed - displayed));
+            push_key(SDLK_SPACE);   // 继续播放到结束, 自动退出
+        });
+        CHECK(player.play() == 0, "play failed");
+        driver.join();
+    }
+    std::remove(path.c_str());
+}
+
+/* 特化转换与通用转换对比: 同一合成媒体分别用特化转换和sws_scale/swr_convert尽快输出到原始文件,
+   两种路径输出逐字节相同, 打印两种路径的每帧平均耗时 */
+static void test_convert_bench(){
+    const double seconds = 4;
+    std::string path = temp_path("bench.mkv");
+    if (!make_media(path, seconds, 1, 1))
+        return;
+    const char* names[2] = {"specialized", "generic"};
+    std::string yuv[2], pcm[2];
+    double v_us[2] = {0, 0}, a_us[2] = {0, 0};
+    int64_t frames = (int64_t)(seconds * FPS);
+    for (int generic = 0; generic < 2; generic++){
+        yuv[generic] = temp_path(generic ? "generic.yuv" : "fast.yuv");
+        pcm[generic] = temp_path(generic ? "generic.pcm" : "fast.pcm");
+        std::string vo = "yuv:" + yuv[generic], ao = "pcm:" + pcm[generic];
+        AvProcessor processor(path.c_str(), 0, !generic);
+        CHECK(processor.invalid == 0, "AvProcessor invalid %d", processor.invalid);
+        PlayerConfig config;
+        config.video_out = vo.c_str();
+        config.audio_out = ao.c_str();
+        config.free_run = 1;
+        config.cache_mb = 0;
+        Player player(&processor, config);
+        CHECK(player.play() == 0, "play failed");
+        AvStats& stats = processor.stats;
+        AvTiming& v_used = generic ? stats.v_convert_sws : stats.v_convert_fast;
+        AvTiming& v_unused = generic ? stats.v_convert_fast : stats.v_convert_sws;
+        AvTiming& a_used = generic ? stats.a_convert_swr : stats.a_convert_fast;
+        AvTiming& a_unused = generic ? stats.a_convert_fast : stats.a_convert_swr;
+        CHECK(v_used.count == frames && v_unused.count == 0, "%s: video converted %lld + %lld of %lld frames",
+            names[generic], (long long)v_used.count.load(), (long long)v_unused.count.load(), (long long)frames);
+        CHECK(a_used.count > 0 && a_unused.count == 0, "%s: audio converted %lld + %lld frames",
+            names[generic], (long long)a_used.count.load(), (long long)a_unused.count.load());
+        v_us[generic] = v_used.avg();
+        a_us[generic] = a_used.avg();
+    }
+    av_log(nullptr, AV_LOG_WARNING, "[bench] video yuv420p %dx%d: specialized %.2f us/frame, sws_scale %.2f us/frame\n",
+        W, H, v_us[0], v_us[1]);
+    av_log(nullptr, AV_LOG_WARNING, "[bench] audio s16 %d ch: specialized %.2f us/frame, swr_convert %.2f us/frame\n",
+        CHANNELS, a_us[0], a_us[1]);
+    std::vector<uint8_t> y0 = read_file(yuv[0].c_str()), y1 = read_file(yuv[1].c_str());
+    std::vector<uint8_t> p0 = read_file(pcm[0].c_str()), p1 = read_file(pcm[1].c_str());
+    CHECK(y0.size() == (size_t)(frames * W * H * 3 / 2), "yuv output has %zu bytes", y0.size());
+    CHECK(y0 == y1, "specialized and sws_scale video output differ");
+    CHECK(!p0.empty() && p0 == p1, "specialized and swr_convert audio output differ (%zu, %zu bytes)", p0.size(), p1.size());
+    for (int i = 0; i < 2; i++){
+        std::remove(yuv[i].c_str());
+        std::remove(pcm[i].c_str());
+    }
+    std::remove(path.c_str());
+}
+
+/* 全范围输入: MJPEG解码得到YUVJ420P(0-255), 不能走平面复制, 经sws_scale转换后亮度在有限范围(16-235)内 */
+static void test_convert_full_range(){
+    const double seconds = 1;
+    std::string path = temp_path("mjpeg.mkv");
+    std::string yuv = temp_path("mjpeg.yuv");
+    std::string vo = "yuv:" + yuv;
+    if (!make_media(path, seconds, 1, 0, AV_CODEC_ID_MJPEG))
+        return;
+    int64_t frames = (int64_t)(seconds * FPS);
+    {
+        AvProcessor processor(path.c_str());
+        CHECK(processor.invalid == 0, "AvProcessor invalid %d", processor.invalid);
+        PlayerConfig config;
+        config.video_out = vo.c_str();
+        config.audio_out = "null";
+        config.free_run = 1;
+        Player player(&processor, config);
+        CHECK(player.play() == 0, "play failed");
+        AvStats& stats = processor.stats;
+        CHECK(stats.v_convert_fast.count == 0 && stats.v_convert_sws.count == frames,
+            "yuvj420p: specialized %lld, sws %lld of %lld frames", (long long)stats.v_convert_fast.count.load(),
+            (long long)stats.v_convert_sws.count.load(), (long long)frames);
+    }
+    // 合成图像的亮度是覆盖0-255的渐变, 转换后应压缩到16-235, 直接复制则会超出
+    std::vector<uint8_t> data = read_file(yuv.c_str());
+    size_t frame_size = W * H * 3 / 2;
+    CHECK(data.size() == frames * frame_size, "yuv output has %zu bytes", data.size());
+    if (data.size() >= frame_size){
+        uint8_t lo = 255, hi = 0;
+        for (size_t i = 0; i < (size_t)(W * H); i++){
+            lo = std::min(lo, data[i]);
+            hi = std::max(hi, data[i]);
+        }
+        CHECK(lo >= 14 && hi <= 237, "luma range %d-%d is not limited range", lo, hi);
+        CHECK(lo <= 24 && hi >= 226, "luma range %d-%d is compressed too much", lo, hi);
+    }
+    std::remove(yuv.c_str());
+    std::remove(path.c_str());
+}
+
+/* trace流事件id: 多个处理器实例、不同流、seek前后(flush序号不同)pts相同的帧id都不同, pts未知时不记录 */
+static void test_trace_flow_id(){
+    std::string path = temp_path("trace.mkv");
+    if (!make_media(path, 1, 1, 1))
+        return;
+    {
+        AvProcessor a(path.c_str()), b(path.c_str());
+        CHECK(a.invalid == 0 && b.invalid == 0, "AvProcessor invalid %d %d", a.invalid, b.invalid);
+        int64_t ids[] = {a.flow_id(0, 0, 100), b.flow_id(0, 0, 100), a.flow_id(1, 0, 100), a.flow_id(0, 1, 100), a.flow_id(0, 0, 101)};
+        int n = sizeof(ids) / sizeof(ids[0]);
+        for (int i = 0; i < n; i++){
+            CHECK(ids[i] >= 0, "id %d is negative: %lld", i, (long long)ids[i]);
+            for (int j = i + 1; j < n; j++)
+                CHECK(ids[i] != ids[j], "ids %d and %d are both %llx", i, j, (unsigned long long)ids[i]);
+        }
+        CHECK(a.flow_id(0, 0, AV_NOPTS_VALUE) == AV_NOPTS_VALUE, "unknown pts must not get a flow id");
+    }
+    std::remove(path.c_str());
+}
+
+/* soak: 短片循环播放几秒, 每秒采样; 循环回到开头的间隔不算帧间隔, ASan构建的内存余量不会误判, 报告每个采样一行 */
+static void test_soak_short(){
+    std::string path = temp_path("soak.mkv");
+    std::string report = temp_path("soak.csv");
+    if (!make_media(path, 1.5, 1, 1))
+        return;
+    int loops = 0;
+    {
+        AvProcessor processor(path.c_str());
+        CHECK(processor.invalid == 0, "AvProcessor invalid %d", processor.invalid);
+        PlayerConfig config = null_config();
+        config.soak = 1;
+        config.soak_config.duration = 6;
+        config.soak_config.interval = 1;
+        config.soak_config.warmup = 1;
+        config.soak_config.report = report.c_str();
+        Player player(&processor, config);
+        CHECK(player.play() == 0, "soak failed");
+        loops = (int)processor.stats.seeks;     // 每次循环seek一次
+    }   // 析构时关闭报告
+    std::vector<uint8_t> csv = read_file(report.c_str());
+    int lines = (int)std::count(csv.begin(), csv.end(), '\n');
+    CHECK(loops >= 2, "%d loops", loops);
+    CHECK(lines >= 5, "soak report has %d lines", lines);
+    std::remove(path.c_str());
+    std::remove(report.c_str());
+}
+
+static const struct{
+    const char* name;
+    void (*run)();
+} tests[] = {
+    {"sync", test_sync},
+    {"sync_video_only", test_sync_video_only},
+    {"sync_audio_only", test_sync_audio_only},
+    {"seek_landing", test_seek_landing},
+    {"seek_stress", test_seek_stress},
+    {"quit_buffered", test_quit_buffered},
+    {"pcm_output", test_pcm_output},
+    {"wall_finish", test_wall_finish},
+    {"cache_seek", test_cache_seek},
+    {"convert_bench", test_convert_bench},
+    {"convert_full_range", test_convert_full_range},
+    {"trace_flow_id", test_trace_flow_id},
+    {"soak_short", test_soak_short},
+};
+
+int main(int argc, char *argv[]){
+    av_log_set_level(AV_LOG_WARNING);   // seek时队列清空等INFO日志太多
+    // 没有设置时用dummy驱动, 不需要显示器和声卡
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+    setenv("SDL_AUDIODRIVER", "dummy", 0);
+    for (auto& test: tests){
+        if (argc == 2 && strcmp(argv[1], test.name) == 0){
+            test.run();
+            av_log(nullptr, failures ? AV_LOG_ERROR : AV_LOG_WARNING, "[test] %s: %s\n", test.name, failures ? "FAILED" : "passed");
+            return failures ? 1 : 0;
+        }
+    }
+    av_log(nullptr, AV_LOG_ERROR, "usage: %s <test>, tests:", argv[0]);
+    for (auto& test: tests)
+        av_log(nullptr, AV_LOG_ERROR, " %s", test.name);
+    av_log(nullptr, AV_LOG_ERROR, "\n");
+    return 1;
+}